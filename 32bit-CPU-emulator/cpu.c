@@ -1,9 +1,13 @@
+#define _GNU_SOURCE
 #include "cpu.h"
+#include "cpu_isa.h"
+#include "cpu_native.h"
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
 #include <ctype.h>
 #include <stdint.h>
+#include <sys/mman.h>
 
 // ------ instruction functions
 static int add_reg(struct cpu *cpu);
@@ -23,9 +27,70 @@ static int put_reg(struct cpu *cpu);
 static int swap_reg(struct cpu *cpu);
 static int push_reg(struct cpu *cpu);
 static int pop_reg(struct cpu *cpu);
+static int lds_reg(struct cpu *cpu);
+static int sts_reg(struct cpu *cpu);
+static int cas_reg(struct cpu *cpu);
+static int fence(struct cpu *cpu);
+static int core_reg(struct cpu *cpu);
+static int push_mask(struct cpu *cpu);
+static int pop_mask(struct cpu *cpu);
+static int push_n(struct cpu *cpu);
+static int drop_n(struct cpu *cpu);
+static int fill_reg(struct cpu *cpu);
+static int copy_reg(struct cpu *cpu);
 
 // ------ tool function
 static int validate_register(struct cpu *cpu, enum cpu_register reg);
+static int32_t *shared_address(struct cpu *cpu, int32_t number);
+static int validate_mask(struct cpu *cpu, int32_t mask);
+static int32_t *stack_range(struct cpu *cpu, int64_t offset, int64_t count);
+static int32_t *stack_reserve(struct cpu *cpu, int64_t count);
+static int32_t *stack_release(struct cpu *cpu, int64_t count);
+static void native_export(struct cpu *cpu, struct cpu_native_state *state);
+static void native_import(struct cpu *cpu, const struct cpu_native_state *state);
+static void close_io(struct cpu *cpu);
+static ssize_t io_read(void *cookie, char *buffer, size_t size);
+static ssize_t io_write(void *cookie, const char *buffer, size_t size);
+static ssize_t buffer_read(void *context, char *buffer, size_t size);
+static ssize_t buffer_write(void *context, const char *buffer, size_t size);
+static int execute(struct cpu *cpu);
+static int execute_watched(struct cpu *cpu);
+static int step_over_breakpoint(struct cpu *cpu);
+static int instruction_boundary(struct cpu *cpu, int32_t index);
+static int find_breakpoint(struct cpu *cpu, int32_t index);
+static int find_watchpoint(struct cpu *cpu, enum cpu_watch_kind kind, int32_t where);
+static int64_t watched_value(struct cpu *cpu, size_t index);
+
+// word patched over an instruction with a breakpoint, any illegal opcode works
+#define BREAKPOINT_TRAP INT32_MIN
+
+// callbacks behind the streams made by cpu_attach_io
+struct cpu_io {
+    cpu_read_fn read;
+    cpu_write_fn write;
+    void *context;
+};
+
+// memory behind the callbacks attached by cpu_attach_buffers
+struct cpu_buffers {
+    const char *input;
+    size_t input_size;
+    size_t input_position;
+    char *output;
+    size_t output_capacity;
+    size_t output_size;
+};
+
+// a breakpoint keeps the word it was patched over
+struct cpu_breakpoint {
+    int32_t index;
+    int32_t opcode;
+};
+
+struct cpu_watchpoint {
+    enum cpu_watch_kind kind;
+    int32_t where;
+};
 
 struct cpu {
     int32_t reg_a;
@@ -33,13 +98,28 @@ struct cpu {
     int32_t reg_c;
     int32_t reg_d;
     int32_t next_instr;
+    int32_t entry;
     int32_t *memory_point;
+    size_t mapped_size;
     int32_t *stack_start;
     int32_t *stack_end;
     int32_t stack_amount;
     int32_t stack_last_val;
     int32_t stack_first_index;
     enum cpu_status status;
+    FILE *input;
+    FILE *output;
+    int32_t *shared;
+    size_t shared_size;
+    int32_t core_id;
+    int owns_io;
+    struct cpu_io io;
+    struct cpu_buffers buffers;
+    struct cpu_breakpoint breakpoints[CPU_MAX_BREAKPOINTS];
+    size_t breakpoint_count;
+    struct cpu_watchpoint watchpoints[CPU_MAX_WATCHPOINTS];
+    size_t watchpoint_count;
+    int watchpoint_hit;
 };
 
 int32_t* cpu_create_memory(FILE *program, size_t stack_capacity, int32_t **stack_bottom)
@@ -104,6 +184,42 @@ int32_t* cpu_create_memory(FILE *program, size_t stack_capacity, int32_t **stack
     return NULL;
 }
 
+int32_t *cpu_create_memory_from_buffer(const void *program, size_t size, size_t stack_capacity, int32_t **stack_bottom)
+{
+    // check if the parameters are NULL
+    assert(program != NULL || size == 0);
+    assert(stack_bottom != NULL);
+
+    // the program has to consist of whole words
+    if (size % 4 != 0) {
+        return NULL;
+    }
+
+    // grow the same way cpu_create_memory does, so both loaders give the same layout
+    size_t words = size / 4;
+    size_t memory_length = 1024;
+    for (size_t i = 0; i < words; i++) {
+        if (i + stack_capacity >= memory_length) {
+            memory_length += 1024;
+        }
+    }
+
+    int32_t *p_memory = calloc(memory_length, sizeof(int32_t));
+    if (p_memory == NULL) {
+        return NULL;
+    }
+
+    // copy the program, words are little-endian
+    const unsigned char *bytes = program;
+    for (size_t i = 0; i < words; i++) {
+        p_memory[i] = (int32_t) ((uint32_t) bytes[4 * i] | (uint32_t) bytes[4 * i + 1] << 8
+            | (uint32_t) bytes[4 * i + 2] << 16 | (uint32_t) bytes[4 * i + 3] << 24);
+    }
+
+    *stack_bottom = &p_memory[memory_length - 1];
+    return p_memory;
+}
+
 struct cpu *cpu_create(int32_t *memory, int32_t *stack_bottom, size_t stack_capacity)
 {
     // check if the parameters are NULL
@@ -123,15 +239,134 @@ struct cpu *cpu_create(int32_t *memory, int32_t *stack_bottom, size_t stack_capa
     cpu->reg_d = 0;
     cpu->stack_amount = 0;
     cpu->next_instr = 0;
+    cpu->entry = 0;
     cpu->stack_start = stack_bottom;
     cpu->stack_end = stack_bottom - stack_capacity + 1;
     cpu->memory_point = memory;
+    cpu->mapped_size = 0;
     cpu->stack_last_val = cpu->stack_start - cpu->memory_point;
     cpu->stack_first_index = cpu->stack_start - cpu->memory_point;
     cpu->status = CPU_OK;
+    cpu->input = stdin;
+    cpu->output = stdout;
+    cpu->shared = NULL;
+    cpu->shared_size = 0;
+    cpu->core_id = 0;
+    cpu->owns_io = 0;
+    cpu->breakpoint_count = 0;
+    cpu->watchpoint_count = 0;
+    cpu->watchpoint_hit = -1;
     return cpu;
 }
 
+struct cpu *cpu_create_mapped(int32_t *memory, size_t mapped_size, int32_t *stack_bottom, size_t stack_capacity)
+{
+    // check if the parameters are NULL
+    assert(memory != NULL);
+    assert(mapped_size != 0);
+
+    struct cpu *cpu = cpu_create(memory, stack_bottom, stack_capacity);
+    if (cpu == NULL) {
+        return NULL;
+    }
+
+    // the memory is released with munmap instead of free
+    cpu->mapped_size = mapped_size;
+    return cpu;
+}
+
+void cpu_set_entry(struct cpu *cpu, int32_t entry)
+{
+    // check if the parameters are NULL
+    assert(cpu != NULL);
+
+    cpu->entry = entry;
+    cpu->next_instr = entry;
+    return;
+}
+
+void cpu_set_io(struct cpu *cpu, FILE *input, FILE *output)
+{
+    // check if the parameters are NULL
+    assert(cpu != NULL);
+    assert(input != NULL);
+    assert(output != NULL);
+
+    close_io(cpu);
+    cpu->input = input;
+    cpu->output = output;
+    return;
+}
+
+void cpu_attach_shared(struct cpu *cpu, int32_t *shared, size_t shared_size, int32_t core_id)
+{
+    // check if the parameters are NULL
+    assert(cpu != NULL);
+    assert(shared != NULL || shared_size == 0);
+
+    cpu->shared = shared;
+    cpu->shared_size = shared_size;
+    cpu->core_id = core_id;
+    return;
+}
+
+int cpu_attach_io(struct cpu *cpu, cpu_read_fn read, cpu_write_fn write, void *context)
+{
+    // check if the parameters are NULL
+    assert(cpu != NULL);
+
+    close_io(cpu);
+    cpu->io.read = read;
+    cpu->io.write = write;
+    cpu->io.context = context;
+
+    // missing callbacks read as EOF and drop the output
+    cookie_io_functions_t input_functions = { read != NULL ? io_read : NULL, NULL, NULL, NULL };
+    cookie_io_functions_t output_functions = { NULL, write != NULL ? io_write : NULL, NULL, NULL };
+    FILE *input = fopencookie(&cpu->io, "r", input_functions);
+    FILE *output = fopencookie(&cpu->io, "w", output_functions);
+    if (input == NULL || output == NULL) {
+        if (input != NULL) {
+            fclose(input);
+        }
+        if (output != NULL) {
+            fclose(output);
+        }
+        return 0;
+    }
+
+    // hand the output over as soon as the guest writes it
+    setvbuf(output, NULL, _IONBF, 0);
+    cpu->input = input;
+    cpu->output = output;
+    cpu->owns_io = 1;
+    return 1;
+}
+
+int cpu_attach_buffers(struct cpu *cpu, const void *input, size_t input_size, void *output, size_t output_capacity)
+{
+    // check if the parameters are NULL
+    assert(cpu != NULL);
+    assert(input != NULL || input_size == 0);
+    assert(output != NULL || output_capacity == 0);
+
+    close_io(cpu);
+    cpu->buffers.input = input;
+    cpu->buffers.input_size = input_size;
+    cpu->buffers.input_position = 0;
+    cpu->buffers.output = output;
+    cpu->buffers.output_capacity = output_capacity;
+    cpu->buffers.output_size = 0;
+    return cpu_attach_io(cpu, buffer_read, buffer_write, &cpu->buffers);
+}
+
+size_t cpu_get_output_size(struct cpu *cpu)
+{
+    // check if the parameters are NULL
+    assert(cpu != NULL);
+    return cpu->buffers.output_size;
+}
+
 int32_t cpu_get_register(struct cpu *cpu, enum cpu_register reg)
 {
     // check if the parameters are NULL
@@ -191,25 +426,141 @@ int32_t cpu_get_stack_size(struct cpu *cpu)
     return cpu->stack_amount;
 }
 
+int32_t cpu_get_next_instruction(struct cpu *cpu)
+{
+    // check if the parameters are NULL
+    assert(cpu != NULL);
+    return cpu->next_instr;
+}
+
+int cpu_set_breakpoint(struct cpu *cpu, int32_t index)
+{
+    // check if the parameters are NULL
+    assert(cpu != NULL);
+
+    // only code can carry a breakpoint
+    if (index < 0 || index >= cpu->stack_end - cpu->memory_point) {
+        return 0;
+    }
+    if (find_breakpoint(cpu, index) >= 0) {
+        return 1;
+    }
+
+    // a trap in an operand would change the operand, not stop anything
+    if (!instruction_boundary(cpu, index)) {
+        return 0;
+    }
+    if (cpu->breakpoint_count == CPU_MAX_BREAKPOINTS) {
+        return 0;
+    }
+
+    // patch the instruction, the interpreter sees the trap as an illegal opcode
+    struct cpu_breakpoint *breakpoint = &cpu->breakpoints[cpu->breakpoint_count++];
+    breakpoint->index = index;
+    breakpoint->opcode = cpu->memory_point[index];
+    cpu->memory_point[index] = BREAKPOINT_TRAP;
+    return 1;
+}
+
+int cpu_clear_breakpoint(struct cpu *cpu, int32_t index)
+{
+    // check if the parameters are NULL
+    assert(cpu != NULL);
+
+    int found = find_breakpoint(cpu, index);
+    if (found < 0) {
+        return 0;
+    }
+    cpu->memory_point[index] = cpu->breakpoints[found].opcode;
+    cpu->breakpoints[found] = cpu->breakpoints[--cpu->breakpoint_count];
+    return 1;
+}
+
+int cpu_set_watchpoint(struct cpu *cpu, enum cpu_watch_kind kind, int32_t where)
+{
+    // check if the parameters are NULL
+    assert(cpu != NULL);
+
+    // check if the register or the stack slot exists
+    if (kind == CPU_WATCH_REGISTER ? where < REGISTER_A || where > REGISTER_D
+            : kind != CPU_WATCH_STACK || where < 0 || where > cpu->stack_start - cpu->stack_end) {
+        return 0;
+    }
+    if (find_watchpoint(cpu, kind, where) >= 0) {
+        return 1;
+    }
+    if (cpu->watchpoint_count == CPU_MAX_WATCHPOINTS) {
+        return 0;
+    }
+    cpu->watchpoints[cpu->watchpoint_count].kind = kind;
+    cpu->watchpoints[cpu->watchpoint_count].where = where;
+    cpu->watchpoint_count++;
+    return 1;
+}
+
+int cpu_clear_watchpoint(struct cpu *cpu, enum cpu_watch_kind kind, int32_t where)
+{
+    // check if the parameters are NULL
+    assert(cpu != NULL);
+
+    int found = find_watchpoint(cpu, kind, where);
+    if (found < 0) {
+        return 0;
+    }
+    cpu->watchpoints[found] = cpu->watchpoints[--cpu->watchpoint_count];
+    cpu->watchpoint_hit = -1;
+    return 1;
+}
+
+int cpu_get_watchpoint_hit(struct cpu *cpu, enum cpu_watch_kind *kind, int32_t *where)
+{
+    // check if the parameters are NULL
+    assert(cpu != NULL);
+    assert(kind != NULL);
+    assert(where != NULL);
+
+    if (cpu->status != CPU_WATCHPOINT || cpu->watchpoint_hit < 0) {
+        return 0;
+    }
+    *kind = cpu->watchpoints[cpu->watchpoint_hit].kind;
+    *where = cpu->watchpoints[cpu->watchpoint_hit].where;
+    return 1;
+}
+
 void cpu_destroy(struct cpu *cpu)
 {
     // check if the parameters are NULL
     assert(cpu != NULL);
 
     // dealocate the memory and reset all the attributes
-    free(cpu->memory_point);
+    close_io(cpu);
+    if (cpu->mapped_size != 0) {
+        munmap(cpu->memory_point, cpu->mapped_size);
+    } else {
+        free(cpu->memory_point);
+    }
     cpu->reg_a = 0;
     cpu->reg_b = 0;
     cpu->reg_c = 0;
     cpu->reg_d = 0;
     cpu->next_instr = 0;
+    cpu->entry = 0;
     cpu->memory_point = NULL;
+    cpu->mapped_size = 0;
     cpu->stack_amount = 0;
     cpu->stack_last_val = 0;
     cpu->stack_first_index = 0;
     cpu->stack_start = NULL;
     cpu->stack_end = NULL;
     cpu->status = CPU_OK;
+    cpu->input = NULL;
+    cpu->output = NULL;
+    cpu->shared = NULL;
+    cpu->shared_size = 0;
+    cpu->core_id = 0;
+    cpu->breakpoint_count = 0;
+    cpu->watchpoint_count = 0;
+    cpu->watchpoint_hit = -1;
     return;
 }
 
@@ -225,9 +576,9 @@ void cpu_reset(struct cpu *cpu)
     cpu->reg_c = 0;
     cpu->reg_d = 0;
     cpu->stack_amount = 0;
-    cpu->stack_last_val = 0;
-    cpu->stack_first_index = 0;
-    cpu->next_instr = 0;
+    cpu->stack_last_val = cpu->stack_start - cpu->memory_point;
+    cpu->stack_first_index = cpu->stack_start - cpu->memory_point;
+    cpu->next_instr = cpu->entry;
     cpu->status = CPU_OK;
     return;
 }
@@ -237,11 +588,28 @@ int cpu_step(struct cpu *cpu)
     // check if the parameters are NULL
     assert(cpu != NULL);
 
+    // continue after the debugger stopped the cpu
+    if (cpu->status == CPU_BREAKPOINT) {
+        return step_over_breakpoint(cpu);
+    }
+    if (cpu->status == CPU_WATCHPOINT) {
+        cpu->status = CPU_OK;
+    }
+
+    // watchpoints swap in the handler comparing the watched values
+    if (cpu->watchpoint_count != 0) {
+        return execute_watched(cpu);
+    }
+    return execute(cpu);
+}
+
+static int execute(struct cpu *cpu)
+{
     // check if the status is CPU_OK
     if (cpu->status != CPU_OK) {
  
         // check if the status is unknown
-        if (cpu->status < CPU_OK || cpu->status > CPU_IO_ERROR) {
+        if (cpu->status < CPU_OK || cpu->status > CPU_WATCHPOINT) {
             cpu->status = CPU_ILLEGAL_INSTRUCTION;
         }
         return 0;
@@ -254,7 +622,13 @@ int cpu_step(struct cpu *cpu)
     }
 
     // check if the instruction is correct
-    if (cpu->memory_point[cpu->next_instr] < 0 || cpu->memory_point[cpu->next_instr] > 18) {
+    if (cpu->memory_point[cpu->next_instr] < 0 || cpu->memory_point[cpu->next_instr] > 29) {
+
+        // a breakpoint stops the cpu before its instruction runs
+        if (cpu->memory_point[cpu->next_instr] == BREAKPOINT_TRAP && find_breakpoint(cpu, cpu->next_instr) >= 0) {
+            cpu->status = CPU_BREAKPOINT;
+            return 0;
+        }
         cpu->status = CPU_ILLEGAL_INSTRUCTION;
         return 0;
     }
@@ -301,44 +675,387 @@ int cpu_step(struct cpu *cpu)
             return swap_reg(cpu);
         case 17:
             return push_reg(cpu);
-        default:
+        case 18:
             return pop_reg(cpu);
+        case 19:
+            return lds_reg(cpu);
+        case 20:
+            return sts_reg(cpu);
+        case 21:
+            return cas_reg(cpu);
+        case 22:
+            return fence(cpu);
+        case 23:
+            return core_reg(cpu);
+        case 24:
+            return push_mask(cpu);
+        case 25:
+            return pop_mask(cpu);
+        case 26:
+            return push_n(cpu);
+        case 27:
+            return drop_n(cpu);
+        case 28:
+            return fill_reg(cpu);
+        default:
+            return copy_reg(cpu);
     }
 }
 
+static inline long long run_steps(struct cpu *cpu, size_t steps, int (*handler)(struct cpu *cpu))
+{
+    size_t i = 1;
+
+    // the first step continues after a debugger stop
+    if (cpu->status != CPU_OK && steps > 0) {
+        if (!cpu_step(cpu)) {
+            return cpu->status == CPU_HALTED ? 1 : -1;
+        }
+        i = 2;
+    }
+
+    // execute steps
+    for (; i < steps + 1; i++) {
+        if (!handler(cpu)) {
+
+            // if the program was correctly halted
+            if (cpu->status == CPU_HALTED) {
+                return i;
+            }
+
+            // if there was an error
+            return i * -1;
+        }
+    }
+
+    return steps;
+}
+
 long long cpu_run(struct cpu *cpu, size_t steps)
 {
     // check if the parameters are NULL
     assert(cpu != NULL);
 
     // if the processor is shut down from the beginning
-    if (cpu->status != CPU_OK) {
+    if (cpu->status != CPU_OK && cpu->status != CPU_BREAKPOINT && cpu->status != CPU_WATCHPOINT) {
  
         // check if the status is unknown
-        if (cpu->status < CPU_OK || cpu->status > CPU_IO_ERROR) {
+        if (cpu->status < CPU_OK || cpu->status > CPU_WATCHPOINT) {
             cpu->status = CPU_ILLEGAL_INSTRUCTION;
         }
         return 0;
     }
 
-    int32_t executed = 0;
+    // the handler is picked once per run, without watchpoints nothing is checked per step
+    if (cpu->watchpoint_count != 0) {
+        return run_steps(cpu, steps, execute_watched);
+    }
+    return run_steps(cpu, steps, execute);
+}
 
-    // execute steps
-    for (size_t i = 1; i < steps + 1; i++) {
-        executed = cpu_step(cpu);
-        if (!executed) {
+size_t cpu_run_batch(struct cpu *const cpus[], size_t count, size_t steps, long long results[])
+{
+    // check if the parameters are NULL
+    assert(cpus != NULL || count == 0);
 
-            // if the program was correctly halted
+    size_t halted = 0;
+    for (size_t i = 0; i < count; i++) {
+        long long result = cpu_run(cpus[i], steps);
+        if (results != NULL) {
+            results[i] = result;
+        }
+        if (cpus[i]->status == CPU_HALTED) {
+            halted++;
+        }
+    }
+    return halted;
+}
+
+long long cpu_run_native(struct cpu *cpu, cpu_native_entry entry, size_t steps)
+{
+    // check if the parameters are NULL
+    assert(cpu != NULL);
+    assert(entry != NULL);
+
+    // if the processor is shut down from the beginning
+    if (cpu->status != CPU_OK) {
+
+        // check if the status is unknown
+        if (cpu->status < CPU_OK || cpu->status > CPU_WATCHPOINT) {
+            cpu->status = CPU_ILLEGAL_INSTRUCTION;
+        }
+        return 0;
+    }
+
+    struct cpu_native_state state;
+    size_t done = 0;
+
+    while (done < steps) {
+
+        // run the translated code until it stops
+        native_export(cpu, &state);
+        done += entry(&state, steps - done);
+        native_import(cpu, &state);
+
+        if (cpu->status != CPU_OK) {
             if (cpu->status == CPU_HALTED) {
-                return i;
+                return done;
+            }
+            return done * -1;
+        }
+
+        if (done == steps) {
+            break;
+        }
+
+        // the translated code handed over an instruction it does not cover
+        done++;
+        if (!cpu_step(cpu)) {
+            if (cpu->status == CPU_HALTED) {
+                return done;
             }
+            return done * -1;
+        }
+    }
+
+    return steps;
+}
+
+static int execute_watched(struct cpu *cpu)
+{
+    int64_t before[CPU_MAX_WATCHPOINTS];
+    for (size_t i = 0; i < cpu->watchpoint_count; i++) {
+        before[i] = watched_value(cpu, i);
+    }
+
+    if (!execute(cpu)) {
+        return 0;
+    }
+
+    // stop right after the instruction that changed a watched value
+    for (size_t i = 0; i < cpu->watchpoint_count; i++) {
+        if (watched_value(cpu, i) != before[i]) {
+            cpu->watchpoint_hit = i;
+            cpu->status = CPU_WATCHPOINT;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int step_over_breakpoint(struct cpu *cpu)
+{
+    int found = find_breakpoint(cpu, cpu->next_instr);
+    cpu->status = CPU_OK;
+    if (found < 0) {
+        return cpu_step(cpu);
+    }
+
+    // run the original instruction once and put the trap back
+    int32_t index = cpu->next_instr;
+    cpu->memory_point[index] = cpu->breakpoints[found].opcode;
+    int result = cpu->watchpoint_count != 0 ? execute_watched(cpu) : execute(cpu);
+    cpu->memory_point[index] = BREAKPOINT_TRAP;
+    return result;
+}
+
+// walks the instructions from the entry, or from 0 for code before it
+static int instruction_boundary(struct cpu *cpu, int32_t index)
+{
+    int32_t at = index < cpu->entry || cpu->entry < 0 ? 0 : cpu->entry;
+    while (at < index) {
+        int32_t opcode = cpu->memory_point[at];
+        int found = opcode == BREAKPOINT_TRAP ? find_breakpoint(cpu, at) : -1;
+        if (found >= 0) {
+            opcode = cpu->breakpoints[found].opcode;
+        }
+        at += cpu_instruction_length(opcode);
+    }
+    return at == index;
+}
+
+static int find_breakpoint(struct cpu *cpu, int32_t index)
+{
+    for (size_t i = 0; i < cpu->breakpoint_count; i++) {
+        if (cpu->breakpoints[i].index == index) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int find_watchpoint(struct cpu *cpu, enum cpu_watch_kind kind, int32_t where)
+{
+    for (size_t i = 0; i < cpu->watchpoint_count; i++) {
+        if (cpu->watchpoints[i].kind == kind && cpu->watchpoints[i].where == where) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int64_t watched_value(struct cpu *cpu, size_t index)
+{
+    const struct cpu_watchpoint *watchpoint = &cpu->watchpoints[index];
+    if (watchpoint->kind == CPU_WATCH_REGISTER) {
+        return cpu_get_register(cpu, watchpoint->where);
+    }
+
+    // a slot above the top of the stack reads as a value no register can hold
+    if (watchpoint->where >= cpu->stack_amount) {
+        return INT64_MIN;
+    }
+    return cpu->memory_point[cpu->stack_first_index - watchpoint->where];
+}
+
+static void native_export(struct cpu *cpu, struct cpu_native_state *state)
+{
+    state->reg_a = cpu->reg_a;
+    state->reg_b = cpu->reg_b;
+    state->reg_c = cpu->reg_c;
+    state->reg_d = cpu->reg_d;
+    state->next_instr = cpu->next_instr;
+    state->memory = cpu->memory_point;
+    state->code_limit = cpu->stack_end - cpu->memory_point;
+    state->stack_size = cpu->stack_start - cpu->stack_end + 1;
+    state->stack_amount = cpu->stack_amount;
+    state->stack_last_val = cpu->stack_last_val;
+    state->stack_first_index = cpu->stack_first_index;
+    state->status = cpu->status;
+    state->input = cpu->input;
+    state->output = cpu->output;
+}
+
+static void native_import(struct cpu *cpu, const struct cpu_native_state *state)
+{
+    cpu->reg_a = state->reg_a;
+    cpu->reg_b = state->reg_b;
+    cpu->reg_c = state->reg_c;
+    cpu->reg_d = state->reg_d;
+    cpu->next_instr = state->next_instr;
+    cpu->stack_amount = state->stack_amount;
+    cpu->stack_last_val = state->stack_last_val;
+    cpu->status = state->status;
+}
+
+static void close_io(struct cpu *cpu)
+{
+    // give up the streams made by cpu_attach_io
+    if (cpu->owns_io) {
+        fclose(cpu->input);
+        fclose(cpu->output);
+        cpu->owns_io = 0;
+    }
+    cpu->input = stdin;
+    cpu->output = stdout;
+}
+
+static ssize_t io_read(void *cookie, char *buffer, size_t size)
+{
+    struct cpu_io *io = cookie;
+    return io->read(io->context, buffer, size);
+}
+
+static ssize_t io_write(void *cookie, const char *buffer, size_t size)
+{
+    // stdio takes 0 as a write error
+    struct cpu_io *io = cookie;
+    ssize_t written = io->write(io->context, buffer, size);
+    return written < 0 ? 0 : written;
+}
+
+static ssize_t buffer_read(void *context, char *buffer, size_t size)
+{
+    struct cpu_buffers *buffers = context;
+    size_t left = buffers->input_size - buffers->input_position;
+    size_t chunk = size < left ? size : left;
+    memcpy(buffer, buffers->input + buffers->input_position, chunk);
+    buffers->input_position += chunk;
+    return chunk;
+}
+
+static ssize_t buffer_write(void *context, const char *buffer, size_t size)
+{
+    // output beyond the capacity is dropped and fails the write
+    struct cpu_buffers *buffers = context;
+    size_t left = buffers->output_capacity - buffers->output_size;
+    size_t chunk = size < left ? size : left;
+    if (chunk == 0 && size != 0) {
+        return -1;
+    }
+    memcpy(buffers->output + buffers->output_size, buffer, chunk);
+    buffers->output_size += chunk;
+    return chunk;
+}
+
+static int32_t *shared_address(struct cpu *cpu, int32_t number)
+{
+    // shared memory is addressed by D + NUM
+    int64_t address = (int64_t) cpu->reg_d + number;
+    if (address < 0 || (uint64_t) address >= cpu->shared_size) {
+        cpu->status = CPU_INVALID_ADDRESS;
+        return NULL;
+    }
+
+    return &cpu->shared[address];
+}
+
+static int validate_mask(struct cpu *cpu, int32_t mask)
+{
+    // bit 0 selects A up to bit 3 selecting D
+    if (mask < 1 || mask > 15) {
+        cpu->status = CPU_ILLEGAL_OPERAND;
+        return 0;
+    }
+
+    return 1;
+}
+
+static int32_t *stack_range(struct cpu *cpu, int64_t offset, int64_t count)
+{
+    // `count` cells from stack offset `offset` have to lie within the stack
+    int64_t start = cpu->stack_last_val + offset;
+    if (count == 0) {
+        return &cpu->memory_point[cpu->stack_last_val];
+    }
+    if (cpu->stack_amount == 0 || start < cpu->stack_last_val || start + count - 1 > cpu->stack_first_index) {
+        cpu->status = CPU_INVALID_STACK_OPERATION;
+        return NULL;
+    }
+
+    return &cpu->memory_point[start];
+}
+
+static int32_t *stack_reserve(struct cpu *cpu, int64_t count)
+{
+    // make room for `count` values as if they were pushed one by one,
+    // returns the new top of the stack
+    int32_t stack_size = cpu->stack_start - cpu->stack_end + 1;
+    if (count > stack_size - cpu->stack_amount) {
+        cpu->status = CPU_INVALID_STACK_OPERATION;
+        return NULL;
+    }
 
-            // if there was an error
-            return i * -1;
-        }
+    cpu->stack_amount += count;
+    if (cpu->stack_amount != 0) {
+        cpu->stack_last_val = cpu->stack_first_index - (cpu->stack_amount - 1);
     }
+    return &cpu->memory_point[cpu->stack_last_val];
+}
 
-    return steps;
+static int32_t *stack_release(struct cpu *cpu, int64_t count)
+{
+    // drop `count` values as if they were popped one by one, returns the old
+    // top of the stack
+    if (count > cpu->stack_amount) {
+        cpu->status = CPU_INVALID_STACK_OPERATION;
+        return NULL;
+    }
+
+    int32_t *top = &cpu->memory_point[cpu->stack_last_val];
+    cpu->stack_amount -= count;
+    cpu->stack_last_val = cpu->stack_first_index - (cpu->stack_amount == 0 ? 0 : cpu->stack_amount - 1);
+    return top;
 }
 
 static int validate_register(struct cpu *cpu, enum cpu_register reg)
@@ -620,7 +1337,7 @@ static int in_reg(struct cpu *cpu)
     }
 
     long long int input = 0;
-    int result = scanf("%lld", &input);
+    int result = fscanf(cpu->input, "%lld", &input);
 
     if (result == EOF) {
         cpu_set_register(cpu, 2, 0);
@@ -657,7 +1374,7 @@ static int get_reg(struct cpu *cpu)
     int32_t input = 0;
 
     // if there is nothing left and the file ends with EOF
-    if ((input = getchar()) == EOF) {
+    if ((input = getc(cpu->input)) == EOF) {
         cpu_set_register(cpu, 2, 0);
         cpu_set_register(cpu, reg, -1);
         cpu->next_instr++;
@@ -684,7 +1401,7 @@ static int out_reg(struct cpu *cpu)
         return 0;
     }
 
-    printf("%d \n", cpu_get_register(cpu, reg));
+    fprintf(cpu->output, "%d \n", cpu_get_register(cpu, reg));
     cpu->next_instr++;
     return 1;
 }
@@ -711,7 +1428,7 @@ static int put_reg(struct cpu *cpu)
     }
 
     // output the value as character
-    printf("%c", reg_value);
+    fputc(reg_value, cpu->output);
     cpu->next_instr++;
     return 1;
 }
@@ -808,3 +1525,331 @@ static int pop_reg(struct cpu *cpu)
     cpu->next_instr++;
     return 1;
 }
+
+static int lds_reg(struct cpu *cpu)
+{
+    // check if the parameters are NULL
+    assert(cpu != NULL);
+
+    // load register
+    cpu->next_instr++;
+    enum cpu_register reg = cpu->memory_point[cpu->next_instr];
+
+    if (!validate_register(cpu, reg)) {
+        cpu->next_instr--;
+        return 0;
+    }
+
+    // load number
+    cpu->next_instr++;
+    int32_t number = cpu->memory_point[cpu->next_instr];
+
+    int32_t *address = shared_address(cpu, number);
+    if (address == NULL) {
+        cpu->next_instr -= 2;
+        return 0;
+    }
+
+    // plain shared accesses are atomic but unordered
+    cpu_set_register(cpu, reg, __atomic_load_n(address, __ATOMIC_RELAXED));
+    cpu->next_instr++;
+    return 1;
+}
+
+static int sts_reg(struct cpu *cpu)
+{
+    // check if the parameters are NULL
+    assert(cpu != NULL);
+
+    // load register
+    cpu->next_instr++;
+    enum cpu_register reg = cpu->memory_point[cpu->next_instr];
+
+    if (!validate_register(cpu, reg)) {
+        cpu->next_instr--;
+        return 0;
+    }
+
+    // load number
+    cpu->next_instr++;
+    int32_t number = cpu->memory_point[cpu->next_instr];
+
+    int32_t *address = shared_address(cpu, number);
+    if (address == NULL) {
+        cpu->next_instr -= 2;
+        return 0;
+    }
+
+    __atomic_store_n(address, cpu_get_register(cpu, reg), __ATOMIC_RELAXED);
+    cpu->next_instr++;
+    return 1;
+}
+
+static int cas_reg(struct cpu *cpu)
+{
+    // check if the parameters are NULL
+    assert(cpu != NULL);
+
+    // load register
+    cpu->next_instr++;
+    enum cpu_register reg = cpu->memory_point[cpu->next_instr];
+
+    if (!validate_register(cpu, reg)) {
+        cpu->next_instr--;
+        return 0;
+    }
+
+    // load number
+    cpu->next_instr++;
+    int32_t number = cpu->memory_point[cpu->next_instr];
+
+    int32_t *address = shared_address(cpu, number);
+    if (address == NULL) {
+        cpu->next_instr -= 2;
+        return 0;
+    }
+
+    // store REG if the cell still holds A, A receives the value found
+    int32_t expected = cpu->reg_a;
+    __atomic_compare_exchange_n(address, &expected, cpu_get_register(cpu, reg), 0,
+        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    cpu->reg_a = expected;
+    cpu->next_instr++;
+    return 1;
+}
+
+static int fence(struct cpu *cpu)
+{
+    // check if the parameters are NULL
+    assert(cpu != NULL);
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    cpu->next_instr++;
+    return 1;
+}
+
+static int core_reg(struct cpu *cpu)
+{
+    // check if the parameters are NULL
+    assert(cpu != NULL);
+
+    // load register
+    cpu->next_instr++;
+    enum cpu_register reg = cpu->memory_point[cpu->next_instr];
+
+    if (!validate_register(cpu, reg)) {
+        cpu->next_instr--;
+        return 0;
+    }
+
+    cpu_set_register(cpu, reg, cpu->core_id);
+    cpu->next_instr++;
+    return 1;
+}
+
+static int push_mask(struct cpu *cpu)
+{
+    // check if the parameters are NULL
+    assert(cpu != NULL);
+
+    // load mask
+    cpu->next_instr++;
+    int32_t mask = cpu->memory_point[cpu->next_instr];
+
+    if (!validate_mask(cpu, mask)) {
+        cpu->next_instr--;
+        return 0;
+    }
+
+    int32_t values[4];
+    int count = 0;
+    for (int reg = REGISTER_A; reg <= REGISTER_D; reg++) {
+        if (mask & (1 << reg)) {
+            values[count++] = cpu_get_register(cpu, reg);
+        }
+    }
+
+    // the first register ends up deepest, like separate pushes
+    int32_t *top = stack_reserve(cpu, count);
+    if (top == NULL) {
+        return 0;
+    }
+    for (int i = 0; i < count; i++) {
+        top[count - 1 - i] = values[i];
+    }
+
+    cpu->next_instr++;
+    return 1;
+}
+
+static int pop_mask(struct cpu *cpu)
+{
+    // check if the parameters are NULL
+    assert(cpu != NULL);
+
+    // load mask
+    cpu->next_instr++;
+    int32_t mask = cpu->memory_point[cpu->next_instr];
+
+    if (!validate_mask(cpu, mask)) {
+        cpu->next_instr--;
+        return 0;
+    }
+
+    int count = 0;
+    for (int reg = REGISTER_A; reg <= REGISTER_D; reg++) {
+        count += (mask >> reg) & 1;
+    }
+
+    // pop in reverse order, so pushm and popm with the same mask pair up
+    int32_t *top = stack_release(cpu, count);
+    if (top == NULL) {
+        return 0;
+    }
+    int i = 0;
+    for (int reg = REGISTER_D; reg >= REGISTER_A; reg--) {
+        if (mask & (1 << reg)) {
+            cpu_set_register(cpu, reg, top[i++]);
+        }
+    }
+    memset(top, 0, count * sizeof(int32_t));
+
+    cpu->next_instr++;
+    return 1;
+}
+
+static int push_n(struct cpu *cpu)
+{
+    // check if the parameters are NULL
+    assert(cpu != NULL);
+
+    // load register
+    cpu->next_instr++;
+    enum cpu_register reg = cpu->memory_point[cpu->next_instr];
+
+    if (!validate_register(cpu, reg)) {
+        cpu->next_instr--;
+        return 0;
+    }
+
+    // C holds the number of copies
+    if (cpu->reg_c < 0) {
+        cpu->status = CPU_ILLEGAL_OPERAND;
+        return 0;
+    }
+
+    int32_t value = cpu_get_register(cpu, reg);
+    int32_t *top = stack_reserve(cpu, cpu->reg_c);
+    if (top == NULL) {
+        return 0;
+    }
+    for (int32_t i = 0; i < cpu->reg_c; i++) {
+        top[i] = value;
+    }
+
+    cpu->next_instr++;
+    return 1;
+}
+
+static int drop_n(struct cpu *cpu)
+{
+    // check if the parameters are NULL
+    assert(cpu != NULL);
+
+    // C holds the number of values
+    if (cpu->reg_c < 0) {
+        cpu->status = CPU_ILLEGAL_OPERAND;
+        return 0;
+    }
+
+    int32_t *top = stack_release(cpu, cpu->reg_c);
+    if (top == NULL) {
+        return 0;
+    }
+    memset(top, 0, cpu->reg_c * sizeof(int32_t));
+
+    cpu->next_instr++;
+    return 1;
+}
+
+static int fill_reg(struct cpu *cpu)
+{
+    // check if the parameters are NULL
+    assert(cpu != NULL);
+
+    // load register
+    cpu->next_instr++;
+    enum cpu_register reg = cpu->memory_point[cpu->next_instr];
+
+    if (!validate_register(cpu, reg)) {
+        cpu->next_instr--;
+        return 0;
+    }
+
+    // load number
+    cpu->next_instr++;
+    int32_t number = cpu->memory_point[cpu->next_instr];
+
+    // C holds the number of cells
+    if (cpu->reg_c < 0) {
+        cpu->next_instr -= 2;
+        cpu->status = CPU_ILLEGAL_OPERAND;
+        return 0;
+    }
+
+    int32_t *cells = stack_range(cpu, (int64_t) cpu->reg_d + number, cpu->reg_c);
+    if (cells == NULL) {
+        cpu->next_instr -= 2;
+        return 0;
+    }
+
+    int32_t value = cpu_get_register(cpu, reg);
+    if (value == 0) {
+        memset(cells, 0, cpu->reg_c * sizeof(int32_t));
+    } else {
+        for (int32_t i = 0; i < cpu->reg_c; i++) {
+            cells[i] = value;
+        }
+    }
+
+    cpu->next_instr++;
+    return 1;
+}
+
+static int copy_reg(struct cpu *cpu)
+{
+    // check if the parameters are NULL
+    assert(cpu != NULL);
+
+    // load register
+    cpu->next_instr++;
+    enum cpu_register reg = cpu->memory_point[cpu->next_instr];
+
+    if (!validate_register(cpu, reg)) {
+        cpu->next_instr--;
+        return 0;
+    }
+
+    // load number
+    cpu->next_instr++;
+    int32_t number = cpu->memory_point[cpu->next_instr];
+
+    // C holds the number of cells
+    if (cpu->reg_c < 0) {
+        cpu->next_instr -= 2;
+        cpu->status = CPU_ILLEGAL_OPERAND;
+        return 0;
+    }
+
+    // copy from stack offset REG to stack offset D + NUM, the ranges may overlap
+    int32_t *source = stack_range(cpu, cpu_get_register(cpu, reg), cpu->reg_c);
+    int32_t *destination = source == NULL ? NULL : stack_range(cpu, (int64_t) cpu->reg_d + number, cpu->reg_c);
+    if (destination == NULL) {
+        cpu->next_instr -= 2;
+        return 0;
+    }
+    memmove(destination, source, cpu->reg_c * sizeof(int32_t));
+
+    cpu->next_instr++;
+    return 1;
+}
@@ -3,6 +3,14 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <sys/types.h>
+
+// bumped on incompatible changes to the functions below
+#define CPU_API_VERSION 1
+
+// debugger limits per cpu
+#define CPU_MAX_BREAKPOINTS 16
+#define CPU_MAX_WATCHPOINTS 8
 
 enum cpu_status
 {
@@ -13,7 +21,9 @@ enum cpu_status
     CPU_INVALID_ADDRESS,
     CPU_INVALID_STACK_OPERATION,
     CPU_DIV_BY_ZERO,
-    CPU_IO_ERROR
+    CPU_IO_ERROR,
+    CPU_BREAKPOINT,
+    CPU_WATCHPOINT
 };
 
 enum cpu_register {
@@ -23,18 +33,45 @@ enum cpu_register {
     REGISTER_D,
 };
 
+// what a watchpoint looks at, stack slots are counted from the bottom
+enum cpu_watch_kind {
+    CPU_WATCH_REGISTER,
+    CPU_WATCH_STACK
+};
+
 struct cpu;
 
+// guest I/O callbacks: read returns the number of bytes read, 0 on EOF and -1
+// on error, write returns the number of bytes written or -1 on error
+typedef ssize_t (*cpu_read_fn)(void *context, char *buffer, size_t size);
+typedef ssize_t (*cpu_write_fn)(void *context, const char *buffer, size_t size);
+
 // function headers
 int32_t* cpu_create_memory(FILE *program, size_t stack_capacity, int32_t **stack_bottom);
+int32_t *cpu_create_memory_from_buffer(const void *program, size_t size, size_t stack_capacity, int32_t **stack_bottom);
 struct cpu *cpu_create(int32_t *memory, int32_t *stack_bottom, size_t stack_capacity);
+struct cpu *cpu_create_mapped(int32_t *memory, size_t mapped_size, int32_t *stack_bottom, size_t stack_capacity);
+void cpu_set_entry(struct cpu *cpu, int32_t entry);
+void cpu_set_io(struct cpu *cpu, FILE *input, FILE *output);
+void cpu_attach_shared(struct cpu *cpu, int32_t *shared, size_t shared_size, int32_t core_id);
+int cpu_attach_io(struct cpu *cpu, cpu_read_fn read, cpu_write_fn write, void *context);
+int cpu_attach_buffers(struct cpu *cpu, const void *input, size_t input_size, void *output, size_t output_capacity);
+size_t cpu_get_output_size(struct cpu *cpu);
 int32_t cpu_get_register(struct cpu *cpu, enum cpu_register reg);
 void cpu_set_register(struct cpu *cpu, enum cpu_register reg, int32_t value);
 enum cpu_status cpu_get_status(struct cpu *cpu);
 int32_t cpu_get_stack_size(struct cpu *cpu);
+int32_t cpu_get_next_instruction(struct cpu *cpu);
+int cpu_set_breakpoint(struct cpu *cpu, int32_t index);
+int cpu_clear_breakpoint(struct cpu *cpu, int32_t index);
+int cpu_set_watchpoint(struct cpu *cpu, enum cpu_watch_kind kind, int32_t where);
+int cpu_clear_watchpoint(struct cpu *cpu, enum cpu_watch_kind kind, int32_t where);
+int cpu_get_watchpoint_hit(struct cpu *cpu, enum cpu_watch_kind *kind, int32_t *where);
 void cpu_destroy(struct cpu *cpu);
 void cpu_reset(struct cpu *cpu);
 int cpu_step(struct cpu *cpu);
 long long cpu_run(struct cpu *cpu, size_t steps);
+size_t cpu_run_batch(struct cpu *const cpus[], size_t count, size_t steps, long long results[]);
+int cpu_run_smp(struct cpu *const cores[], size_t count, size_t steps, long long results[]);
 
 #endif // CPU_H
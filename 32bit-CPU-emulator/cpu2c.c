@@ -0,0 +1,337 @@
+#include "cpu.h"
+#include "cpu_isa.h"
+#include "cpu_native.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *const register_names[] = { "a", "b", "c", "d" };
+
+static const char *const preamble =
+    "#include \"cpu_native.h\"\n"
+    "#include <stdint.h>\n"
+    "#include <stdio.h>\n"
+    "\n"
+    "#define STEP(i) do { if (left == 0) { pc = (i); goto out; } left--; } while (0)\n"
+    "#define STOP(i, code) do { pc = (i); s->status = (code); goto out; } while (0)\n"
+    "#define YIELD(i) do { pc = (i); goto out; } while (0)\n"
+    "\n"
+    "static inline enum cpu_status native_in(FILE *input, int32_t *reg, int32_t *c)\n"
+    "{\n"
+    "    long long int value = 0;\n"
+    "    int result = fscanf(input, \"%lld\", &value);\n"
+    "\n"
+    "    if (result == EOF) {\n"
+    "        *c = 0;\n"
+    "        *reg = -1;\n"
+    "        return CPU_OK;\n"
+    "    }\n"
+    "    if (result != 1 || value < INT32_MIN || value > INT32_MAX) {\n"
+    "        return CPU_IO_ERROR;\n"
+    "    }\n"
+    "    *reg = (int32_t) value;\n"
+    "    return CPU_OK;\n"
+    "}\n"
+    "\n"
+    "static inline void native_get(FILE *input, int32_t *reg, int32_t *c)\n"
+    "{\n"
+    "    int byte = getc(input);\n"
+    "\n"
+    "    if (byte == EOF) {\n"
+    "        *c = 0;\n"
+    "        *reg = -1;\n"
+    "        return;\n"
+    "    }\n"
+    "    *reg = byte;\n"
+    "}\n"
+    "\n";
+
+static bool valid_register(int32_t reg)
+{
+    return reg >= REGISTER_A && reg <= REGISTER_D;
+}
+
+static int32_t *read_program(FILE *program, size_t *length)
+{
+    size_t capacity = 1024;
+    size_t count = 0;
+    int32_t *words = malloc(capacity * sizeof(int32_t));
+    if (words == NULL) {
+        return NULL;
+    }
+
+    // read the program 4 bytes at a time, little-endian like the loader
+    unsigned char bytes[4];
+    size_t got;
+    while ((got = fread(bytes, 1, 4, program)) == 4) {
+        if (count == capacity) {
+            int32_t *new_words = realloc(words, 2 * capacity * sizeof(int32_t));
+            if (new_words == NULL) {
+                free(words);
+                return NULL;
+            }
+            words = new_words;
+            capacity *= 2;
+        }
+        words[count++] = (int32_t) ((uint32_t) bytes[0] | (uint32_t) bytes[1] << 8
+            | (uint32_t) bytes[2] << 16 | (uint32_t) bytes[3] << 24);
+    }
+
+    // the program has to consist of whole words
+    if (got != 0 || ferror(program)) {
+        free(words);
+        return NULL;
+    }
+
+    *length = count;
+    return words;
+}
+
+static void emit_image(FILE *out, const int32_t *words, size_t length)
+{
+    fprintf(out, "const unsigned cpu_native_abi = CPU_NATIVE_ABI;\n\n");
+    fprintf(out, "const unsigned char cpu_native_image[] = {");
+    for (size_t i = 0; i < length * 4; i++) {
+        uint32_t word = (uint32_t) words[i / 4];
+        fprintf(out, "%s0x%02x,", i % 12 == 0 ? "\n    " : " ", (word >> (8 * (i % 4))) & 0xff);
+    }
+    if (length == 0) {
+        fprintf(out, "\n    0x00,");
+    }
+    fprintf(out, "\n};\n\n");
+    fprintf(out, "const size_t cpu_native_image_size = %zu;\n\n", length * 4);
+}
+
+// continue with the instruction at `target`
+static void emit_jump(FILE *out, int64_t target, size_t length)
+{
+    if (target >= 0 && target < (int64_t) length) {
+        fprintf(out, " goto L%lld;", (long long) target);
+    } else {
+        fprintf(out, " { pc = %lld; goto outside; }", (long long) target);
+    }
+}
+
+static void emit_instruction(FILE *out, const int32_t *words, size_t length, size_t index)
+{
+    int32_t opcode = words[index];
+    int64_t next = (int64_t) index + cpu_instruction_length(opcode);
+    const char *reg = NULL;
+    const char *other = NULL;
+
+    fprintf(out, "L%zu:", index);
+
+    // unknown opcodes fault the same way cpu_step does
+    if (opcode < 0 || opcode >= CPU_OPCODE_COUNT) {
+        fprintf(out, " STEP(%zu); STOP(%zu, CPU_ILLEGAL_INSTRUCTION);\n", index, index);
+        return;
+    }
+
+    // shared memory and block instructions and operands running past
+    // the image are left to the interpreter
+    if (opcode > 18 || next > (int64_t) length) {
+        fprintf(out, " YIELD(%zu);\n", index);
+        return;
+    }
+
+    fprintf(out, " STEP(%zu);", index);
+
+    // check the register operands up front
+    if (opcode >= 2 && opcode != 8) {
+        if (!valid_register(words[index + 1])) {
+            fprintf(out, " STOP(%zu, CPU_ILLEGAL_OPERAND);\n", index);
+            return;
+        }
+        reg = register_names[words[index + 1]];
+    }
+    if (opcode == 16) {
+        if (!valid_register(words[index + 2])) {
+            fprintf(out, " STOP(%zu, CPU_ILLEGAL_OPERAND);\n", index);
+            return;
+        }
+        other = register_names[words[index + 2]];
+    }
+
+    switch (opcode) {
+        case 0:
+            break;
+        case 1:
+            fprintf(out, " STOP(%zu, CPU_HALTED);\n", index);
+            return;
+        case 2:
+            fprintf(out, " a = (int32_t) ((uint32_t) a + (uint32_t) %s);", reg);
+            break;
+        case 3:
+            fprintf(out, " a = (int32_t) ((uint32_t) a - (uint32_t) %s);", reg);
+            break;
+        case 4:
+            fprintf(out, " a = (int32_t) ((uint32_t) a * (uint32_t) %s);", reg);
+            break;
+        case 5:
+            fprintf(out, " if (%s == 0) STOP(%zu, CPU_DIV_BY_ZERO); a /= %s;", reg, index, reg);
+            break;
+        case 6:
+            fprintf(out, " %s = (int32_t) ((uint32_t) %s + 1);", reg, reg);
+            break;
+        case 7:
+            fprintf(out, " %s = (int32_t) ((uint32_t) %s - 1);", reg, reg);
+            break;
+        case 8:
+            fprintf(out, " if (c != 0)");
+            emit_jump(out, words[index + 1], length);
+            break;
+        case 9:
+            fprintf(out, " %s = %d;", reg, words[index + 2]);
+            break;
+        case 10:
+        case 11:
+            fprintf(out, " idx = (int64_t) last + d + %d;", words[index + 2]);
+            fprintf(out, " if (idx > first || idx < last || amount == 0)"
+                " STOP(%zu, CPU_INVALID_STACK_OPERATION);", index);
+            if (opcode == 10) {
+                fprintf(out, " %s = m[idx];", reg);
+            } else {
+                fprintf(out, " m[idx] = %s;", reg);
+            }
+            break;
+        case 12:
+            fprintf(out, " if (native_in(s->input, &%s, &c) != CPU_OK) STOP(%zu, CPU_IO_ERROR);", reg, index);
+            break;
+        case 13:
+            fprintf(out, " native_get(s->input, &%s, &c);", reg);
+            break;
+        case 14:
+            fprintf(out, " fprintf(s->output, \"%%d \\n\", %s);", reg);
+            break;
+        case 15:
+            fprintf(out, " if (%s < 0 || %s > 255) STOP(%zu, CPU_ILLEGAL_OPERAND); fputc(%s, s->output);",
+                reg, reg, index, reg);
+            break;
+        case 16:
+            fprintf(out, " tmp = %s; %s = %s; %s = tmp;", reg, reg, other, other);
+            break;
+        case 17:
+            fprintf(out, " if (amount == size) STOP(%zu, CPU_INVALID_STACK_OPERATION);"
+                " if (amount != 0) last--; m[last] = %s; amount++;", index, reg);
+            break;
+        default:
+            fprintf(out, " if (amount == 0) STOP(%zu, CPU_INVALID_STACK_OPERATION);"
+                " %s = m[last]; m[last] = 0; amount--; if (amount != 0) last++;", index, reg);
+            break;
+    }
+
+    if (next != (int64_t) index + 1 || next >= (int64_t) length) {
+        emit_jump(out, next, length);
+    }
+    fprintf(out, "\n");
+}
+
+static void emit_run(FILE *out, const int32_t *words, size_t length)
+{
+    fprintf(out,
+        "size_t cpu_native_run(struct cpu_native_state *s, size_t steps)\n"
+        "{\n"
+        "    int32_t a = s->reg_a, b = s->reg_b, c = s->reg_c, d = s->reg_d;\n"
+        "    int32_t *const m = s->memory;\n"
+        "    const int32_t limit = s->code_limit, size = s->stack_size, first = s->stack_first_index;\n"
+        "    int32_t amount = s->stack_amount, last = s->stack_last_val;\n"
+        "    int32_t pc = s->next_instr, tmp;\n"
+        "    int64_t idx;\n"
+        "    size_t left = steps;\n"
+        "\n"
+        "    (void) m;\n"
+        "    (void) size;\n"
+        "    (void) first;\n"
+        "    (void) tmp;\n"
+        "    (void) idx;\n"
+        "\n"
+        "    switch (pc) {\n");
+    for (size_t i = 0; i < length; i++) {
+        fprintf(out, "        case %zu: goto L%zu;\n", i, i);
+    }
+    fprintf(out,
+        "        default: goto outside;\n"
+        "    }\n"
+        "\n");
+
+    for (size_t i = 0; i < length; i++) {
+        emit_instruction(out, words, length, i);
+    }
+
+    fprintf(out,
+        "\n"
+        "outside:\n"
+        "    if (pc < 0 || pc >= limit) {\n"
+        "        STEP(pc);\n"
+        "        STOP(pc, CPU_INVALID_ADDRESS);\n"
+        "    }\n"
+        "\n"
+        "    // the memory between the image and the stack is zero, i.e. nops\n"
+        "    if (left < (size_t) (limit - pc)) {\n"
+        "        pc += (int32_t) left;\n"
+        "        left = 0;\n"
+        "        goto out;\n"
+        "    }\n"
+        "    left -= (size_t) (limit - pc);\n"
+        "    pc = limit;\n"
+        "    goto outside;\n"
+        "\n"
+        "out:\n"
+        "    s->reg_a = a;\n"
+        "    s->reg_b = b;\n"
+        "    s->reg_c = c;\n"
+        "    s->reg_d = d;\n"
+        "    s->next_instr = pc;\n"
+        "    s->stack_amount = amount;\n"
+        "    s->stack_last_val = last;\n"
+        "    return steps - left;\n"
+        "}\n");
+}
+
+static void usage(void)
+{
+    printf("Invalid arguments, run ./cpu2c FILE [OUTPUT]\n");
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2 || argc > 3) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    FILE *fptr;
+    if ((fptr = fopen(argv[1], "rb")) == NULL) {
+        perror(argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    size_t length;
+    int32_t *words = read_program(fptr, &length);
+    fclose(fptr);
+    if (words == NULL) {
+        fprintf(stderr, "%s: not a valid program\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    FILE *out = stdout;
+    if (argc == 3 && (out = fopen(argv[2], "w")) == NULL) {
+        perror(argv[2]);
+        free(words);
+        return EXIT_FAILURE;
+    }
+
+    fprintf(out, "// generated by cpu2c from %s, do not edit\n", argv[1]);
+    fputs(preamble, out);
+    emit_image(out, words, length);
+    emit_run(out, words, length);
+
+    free(words);
+    if (out != stdout && fclose(out) != 0) {
+        perror(argv[2]);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
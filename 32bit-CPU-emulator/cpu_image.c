@@ -0,0 +1,215 @@
+#include "cpu_image.h"
+#include "cpu_isa.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// ------ tool functions
+static int read_at(int fd, void *buffer, size_t size, uint64_t offset);
+
+uint32_t cpu_image_checksum(const void *data, size_t size)
+{
+    // CRC-32 (IEEE), four bits at a time
+    static const uint32_t table[16] = {
+        0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+        0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+    };
+    const unsigned char *bytes = data;
+    uint32_t crc = 0xffffffff;
+    for (size_t i = 0; i < size; i++) {
+        crc ^= bytes[i];
+        crc = (crc >> 4) ^ table[crc & 15];
+        crc = (crc >> 4) ^ table[crc & 15];
+    }
+    return ~crc;
+}
+
+int cpu_image_open(struct cpu_image *image, int fd)
+{
+    // check if the parameters are NULL
+    assert(image != NULL);
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !read_at(fd, &image->header, sizeof(image->header), 0)) {
+        return 0;
+    }
+
+    struct cpu_image_header *header = &image->header;
+    image->fd = fd;
+    image->program = NULL;
+    image->symbols = NULL;
+    if (memcmp(header->magic, CPU_IMAGE_MAGIC, 4) != 0 || header->version != CPU_IMAGE_VERSION
+        || header->section_count > CPU_IMAGE_MAX_SECTIONS) {
+        errno = EINVAL;
+        return 0;
+    }
+
+    // check the section table
+    for (uint16_t i = 0; i < header->section_count; i++) {
+        const struct cpu_image_section *section = &header->sections[i];
+        if (section->offset % CPU_IMAGE_ALIGN != 0 || section->offset > (uint64_t) info.st_size
+            || section->size > (uint64_t) info.st_size - section->offset) {
+            errno = EINVAL;
+            return 0;
+        }
+        if (section->kind == CPU_IMAGE_PROGRAM) {
+            image->program = section;
+        } else if (section->kind == CPU_IMAGE_SYMBOLS) {
+            image->symbols = section;
+        }
+    }
+
+    // the program has to consist of whole words, entry included
+    if (image->program == NULL || image->program->size % 4 != 0 || image->program->size / 4 > INT32_MAX
+        || (header->entry != 0 && header->entry >= image->program->size / 4)) {
+        errno = EINVAL;
+        return 0;
+    }
+    return 1;
+}
+
+int32_t *cpu_image_map(const struct cpu_image *image, size_t stack_capacity,
+    int32_t **stack_bottom, size_t *mapped_size)
+{
+    // check if the parameters are NULL
+    assert(image != NULL);
+    assert(stack_bottom != NULL);
+    assert(mapped_size != NULL);
+
+    const struct cpu_image_section *program = image->program;
+    size_t words = program->size / 4;
+
+    // grow the same way cpu_create_memory does, so both loaders give the same layout
+    size_t memory_length = 1024;
+    for (size_t i = 0; i < words; i++) {
+        if (i + stack_capacity >= memory_length) {
+            memory_length += 1024;
+        }
+    }
+
+    size_t bytes = memory_length * sizeof(int32_t);
+    char *memory = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        return NULL;
+    }
+
+    // map the program pages that lie below the stack in place, copy the rest
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t program_pages = (program->size + page - 1) / page * page;
+    size_t code_bytes = memory_length > stack_capacity ? (memory_length - stack_capacity) * sizeof(int32_t) : 0;
+    size_t mapped = program_pages <= code_bytes ? program_pages : code_bytes / page * page;
+    if (program->offset % page != 0) {
+        mapped = 0;
+    }
+
+    if (mapped > 0) {
+        if (mmap(memory, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+                image->fd, program->offset) == MAP_FAILED) {
+            munmap(memory, bytes);
+            return NULL;
+        }
+
+        // whatever follows the program in its last page has to read as nops
+        for (size_t i = program->size; i < mapped; i++) {
+            if (memory[i] != 0) {
+                memset(memory + program->size, 0, mapped - program->size);
+                break;
+            }
+        }
+    }
+    if (mapped < program->size
+        && !read_at(image->fd, memory + mapped, program->size - mapped, program->offset + mapped)) {
+        munmap(memory, bytes);
+        return NULL;
+    }
+
+    *stack_bottom = (int32_t *) memory + memory_length - 1;
+    *mapped_size = bytes;
+    return (int32_t *) memory;
+}
+
+int cpu_image_verify(const struct cpu_image *image, const int32_t *memory)
+{
+    // check if the parameters are NULL
+    assert(image != NULL);
+    assert(memory != NULL);
+
+    // this reads every program page, mapping alone leaves them on disk
+    if (cpu_image_checksum(memory, image->program->size) != image->program->checksum) {
+        errno = EINVAL;
+        return 0;
+    }
+
+    // the entry has to be the first word of an instruction
+    uint32_t at = 0;
+    while (at < image->header.entry) {
+        at += cpu_instruction_length(memory[at]);
+    }
+    if (at != image->header.entry) {
+        errno = EINVAL;
+        return 0;
+    }
+    return 1;
+}
+
+int cpu_image_find_symbol(const struct cpu_image *image, const char *name, int32_t *index)
+{
+    // check if the parameters are NULL
+    assert(image != NULL);
+    assert(name != NULL);
+    assert(index != NULL);
+
+    if (image->symbols == NULL || image->symbols->size == 0) {
+        return 0;
+    }
+
+    unsigned char *symbols = malloc(image->symbols->size);
+    if (symbols == NULL || !read_at(image->fd, symbols, image->symbols->size, image->symbols->offset)) {
+        free(symbols);
+        return 0;
+    }
+
+    // walk the records until the name matches
+    size_t length = strlen(name);
+    size_t position = 0;
+    int found = 0;
+    while (!found && position + 8 <= image->symbols->size) {
+        uint32_t record[2];
+        memcpy(record, symbols + position, sizeof(record));
+        position += sizeof(record);
+        if (record[1] > image->symbols->size - position) {
+            break;
+        }
+        if (record[1] == length && memcmp(symbols + position, name, length) == 0) {
+            *index = (int32_t) record[0];
+            found = 1;
+        }
+        position += (record[1] + 3) / 4 * 4;
+    }
+
+    free(symbols);
+    return found;
+}
+
+static int read_at(int fd, void *buffer, size_t size, uint64_t offset)
+{
+    size_t done = 0;
+    while (done < size) {
+        ssize_t got = pread(fd, (char *) buffer + done, size - done, offset + done);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            if (got == 0) {
+                errno = EINVAL;
+            }
+            return 0;
+        }
+        done += got;
+    }
+    return 1;
+}
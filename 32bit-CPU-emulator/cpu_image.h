@@ -0,0 +1,61 @@
+#ifndef CPU_IMAGE_H
+#define CPU_IMAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Program image container. The header and the symbol records are in host
+// byte order, an image written on a host of the other byte order fails the
+// version check. The program words stay little-endian like in .bin files and
+// are mapped as they are, so images only run on little-endian hosts.
+//
+// The file starts with a struct cpu_image_header. Every section starts at a
+// multiple of CPU_IMAGE_ALIGN and is zero padded up to the next one, so the
+// program section can be mapped straight into the cpu memory.
+#define CPU_IMAGE_MAGIC "C32I"
+#define CPU_IMAGE_VERSION 1
+#define CPU_IMAGE_ALIGN 4096
+#define CPU_IMAGE_MAX_SECTIONS 4
+
+enum cpu_image_section_kind
+{
+    CPU_IMAGE_UNUSED,
+    CPU_IMAGE_PROGRAM,
+    CPU_IMAGE_SYMBOLS
+};
+
+struct cpu_image_section {
+    uint32_t kind;
+    uint32_t checksum;
+    uint64_t offset;
+    uint64_t size;
+};
+
+struct cpu_image_header {
+    char magic[4];
+    uint16_t version;
+    uint16_t section_count;
+    uint32_t entry;
+    uint32_t stack_capacity;
+    struct cpu_image_section sections[CPU_IMAGE_MAX_SECTIONS];
+};
+
+// A symbol record is a uint32_t instruction index, a uint32_t name length
+// and the name itself, zero padded to a multiple of 4 bytes.
+
+struct cpu_image {
+    int fd;
+    struct cpu_image_header header;
+    const struct cpu_image_section *program;
+    const struct cpu_image_section *symbols;
+};
+
+// function headers
+uint32_t cpu_image_checksum(const void *data, size_t size);
+int cpu_image_open(struct cpu_image *image, int fd);
+int32_t *cpu_image_map(const struct cpu_image *image, size_t stack_capacity,
+    int32_t **stack_bottom, size_t *mapped_size);
+int cpu_image_verify(const struct cpu_image *image, const int32_t *memory);
+int cpu_image_find_symbol(const struct cpu_image *image, const char *name, int32_t *index);
+
+#endif // CPU_IMAGE_H
@@ -0,0 +1,38 @@
+#ifndef CPU_ISA_H
+#define CPU_ISA_H
+
+#include <stdint.h>
+
+// opcodes run from 0 to CPU_OPCODE_COUNT - 1, anything else is illegal
+#define CPU_OPCODE_COUNT 30
+
+// words an instruction takes, opcode included; illegal opcodes fault before
+// reading operands, so they count as a single word
+static inline int cpu_instruction_length(int32_t opcode)
+{
+    if (opcode < 0 || opcode >= CPU_OPCODE_COUNT) {
+        return 1;
+    }
+
+    switch (opcode) {
+        case 0:
+        case 1:
+        case 22:
+        case 27:
+            return 1;
+        case 9:
+        case 10:
+        case 11:
+        case 16:
+        case 19:
+        case 20:
+        case 21:
+        case 28:
+        case 29:
+            return 3;
+        default:
+            return 2;
+    }
+}
+
+#endif // CPU_ISA_H
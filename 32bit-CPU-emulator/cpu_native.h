@@ -0,0 +1,45 @@
+#ifndef CPU_NATIVE_H
+#define CPU_NATIVE_H
+
+#include "cpu.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// bump whenever struct cpu_native_state or the exported symbols change
+#define CPU_NATIVE_ABI 2
+
+// symbols exported by a translated program (see cpu2c)
+#define CPU_NATIVE_ABI_SYMBOL "cpu_native_abi"
+#define CPU_NATIVE_IMAGE_SYMBOL "cpu_native_image"
+#define CPU_NATIVE_IMAGE_SIZE_SYMBOL "cpu_native_image_size"
+#define CPU_NATIVE_RUN_SYMBOL "cpu_native_run"
+
+// plain copy of the cpu state handed to the translated code
+struct cpu_native_state {
+    int32_t reg_a;
+    int32_t reg_b;
+    int32_t reg_c;
+    int32_t reg_d;
+    int32_t next_instr;
+    int32_t *memory;
+    int32_t code_limit;
+    int32_t stack_size;
+    int32_t stack_amount;
+    int32_t stack_last_val;
+    int32_t stack_first_index;
+    enum cpu_status status;
+    FILE *input;
+    FILE *output;
+};
+
+// Executes at most `steps` instructions and returns how many were executed,
+// including the one that halted or faulted. When it returns early with
+// status CPU_OK, next_instr points to an instruction the translated code
+// does not cover and the caller has to step it with the interpreter.
+typedef size_t (*cpu_native_entry)(struct cpu_native_state *state, size_t steps);
+
+// same contract and return value as cpu_run, executing through `entry`
+long long cpu_run_native(struct cpu *cpu, cpu_native_entry entry, size_t steps);
+
+#endif // CPU_NATIVE_H
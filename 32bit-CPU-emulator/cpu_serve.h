@@ -0,0 +1,43 @@
+#ifndef CPU_SERVE_H
+#define CPU_SERVE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// largest input a single request may carry
+#define CPU_SERVE_MAX_INPUT (64u * 1024 * 1024)
+
+// Every message is a fixed header in host byte order followed by
+// `input_size` (request) or `output_size` (response) raw bytes.
+// A connection may carry any number of requests, answered in order.
+struct cpu_serve_request {
+    uint32_t program;
+    uint32_t input_size;
+    uint64_t steps;
+};
+
+enum cpu_serve_error
+{
+    CPU_SERVE_OK,
+    CPU_SERVE_UNKNOWN_PROGRAM,
+    CPU_SERVE_TOO_LARGE,
+    CPU_SERVE_NO_MEMORY
+};
+
+struct cpu_serve_response {
+    uint32_t error;
+    int32_t status;
+    int64_t result;
+    int32_t registers[4];
+    int32_t stack_size;
+    uint32_t output_size;
+};
+
+// function headers
+int cpu_serve(const char *socket_path, size_t stack_capacity, bool capacity_given, char *const paths[], size_t count);
+int cpu_serve_call(const char *socket_path, const struct cpu_serve_request *request,
+    const void *input, struct cpu_serve_response *response, FILE *output);
+
+#endif // CPU_SERVE_H
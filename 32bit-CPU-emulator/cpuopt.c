@@ -0,0 +1,595 @@
+#include "cpu.h"
+#include "cpu_isa.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ALL_REGISTERS 15
+
+struct instruction {
+    int32_t opcode;
+    int32_t operands[2];
+    int32_t index;
+    bool target;
+    bool deleted;
+};
+
+struct program {
+    int32_t *memory;
+    size_t words;
+    struct instruction *code;
+    size_t count;
+};
+
+// facts about the registers known at one point of the program
+struct knowledge {
+    bool known[4];
+    int32_t value[4];
+};
+
+// instructions that only move values between registers and can't fault
+static bool is_pure(const struct instruction *ins)
+{
+    switch (ins->opcode) {
+        case 0:
+        case 2:
+        case 3:
+        case 4:
+        case 6:
+        case 7:
+        case 9:
+        case 16:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool valid_register(int32_t reg)
+{
+    return reg >= REGISTER_A && reg <= REGISTER_D;
+}
+
+// register operands are checked once here, invalid ones make the instruction a fault
+static bool has_valid_operands(const struct instruction *ins)
+{
+    switch (ins->opcode) {
+        case 0:
+        case 1:
+        case 8:
+        case 22:
+        case 24:
+        case 25:
+        case 27:
+            return true;
+        case 16:
+            return valid_register(ins->operands[0]) && valid_register(ins->operands[1]);
+        default:
+            return valid_register(ins->operands[0]);
+    }
+}
+
+static void register_sets(const struct instruction *ins, int *reads, int *writes)
+{
+    int reg = ins->operands[0];
+    switch (ins->opcode) {
+        case 2:
+        case 3:
+        case 4:
+            *reads = 1 << REGISTER_A | 1 << reg;
+            *writes = 1 << REGISTER_A;
+            break;
+        case 6:
+        case 7:
+            *reads = 1 << reg;
+            *writes = 1 << reg;
+            break;
+        case 9:
+            *reads = 0;
+            *writes = 1 << reg;
+            break;
+        case 16:
+            *reads = 1 << reg | 1 << ins->operands[1];
+            *writes = *reads;
+            break;
+        default:
+            *reads = 0;
+            *writes = 0;
+            break;
+    }
+}
+
+// registers an impure instruction may change
+static int clobbered_registers(const struct instruction *ins)
+{
+    switch (ins->opcode) {
+        case 5:
+            return 1 << REGISTER_A;
+        case 10:
+        case 18:
+        case 19:
+        case 23:
+            return 1 << ins->operands[0];
+        case 12:
+        case 13:
+            return 1 << ins->operands[0] | 1 << REGISTER_C;
+        case 21:
+            return 1 << REGISTER_A;
+        case 25:
+            return ins->operands[0] & ALL_REGISTERS;
+        default:
+            return 0;
+    }
+}
+
+static bool read_program(FILE *fptr, struct program *program)
+{
+    size_t capacity = 1024;
+    size_t words = 0;
+    int32_t *memory = malloc(capacity * sizeof(int32_t));
+    unsigned char bytes[4];
+    size_t got;
+
+    // read the program 4 bytes at a time, little-endian like the loader
+    while (memory != NULL && (got = fread(bytes, 1, 4, fptr)) == 4) {
+        if (words == capacity) {
+            int32_t *new_memory = realloc(memory, 2 * capacity * sizeof(int32_t));
+            if (new_memory == NULL) {
+                free(memory);
+                return false;
+            }
+            memory = new_memory;
+            capacity *= 2;
+        }
+        memory[words++] = (int32_t) ((uint32_t) bytes[0] | (uint32_t) bytes[1] << 8
+            | (uint32_t) bytes[2] << 16 | (uint32_t) bytes[3] << 24);
+    }
+    if (memory == NULL || got != 0 || ferror(fptr)) {
+        free(memory);
+        return false;
+    }
+
+    // decode it linearly, instructions can't be longer than their words
+    program->memory = memory;
+    program->words = words;
+    program->code = malloc((words + 1) * sizeof(struct instruction));
+    program->count = 0;
+    if (program->code == NULL) {
+        free(memory);
+        return false;
+    }
+    for (size_t i = 0; i < words; i += cpu_instruction_length(memory[i])) {
+        struct instruction *ins = &program->code[program->count++];
+        memset(ins, 0, sizeof(*ins));
+        ins->opcode = memory[i];
+        ins->index = i;
+        for (int k = 1; k < cpu_instruction_length(memory[i]); k++) {
+            ins->operands[k - 1] = i + k < words ? memory[i + k] : 0;
+        }
+    }
+    return true;
+}
+
+static struct instruction *find_instruction(struct program *program, int64_t index)
+{
+    // binary search over the input indices
+    size_t low = 0;
+    size_t high = program->count;
+    while (low < high) {
+        size_t middle = (low + high) / 2;
+        if (program->code[middle].index < index) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low < program->count && program->code[low].index == index ? &program->code[low] : NULL;
+}
+
+// first live instruction at or after `index` in input numbering
+static struct instruction *resolve(struct program *program, int64_t index)
+{
+    for (size_t i = 0; i < program->count; i++) {
+        if (!program->code[i].deleted && program->code[i].index >= index) {
+            return &program->code[i];
+        }
+    }
+    return NULL;
+}
+
+static bool can_optimize(struct program *program)
+{
+    // the last instruction must not run past the program
+    if (program->count > 0) {
+        const struct instruction *last = &program->code[program->count - 1];
+        if ((size_t) last->index + cpu_instruction_length(last->opcode) > program->words) {
+            return false;
+        }
+    }
+
+    // every jump into the program has to hit the start of an instruction
+    for (size_t i = 0; i < program->count; i++) {
+        const struct instruction *ins = &program->code[i];
+        if (ins->opcode != 8) {
+            continue;
+        }
+        int32_t target = ins->operands[0];
+        if (target < 0 || (size_t) target >= program->words) {
+            continue;
+        }
+        struct instruction *destination = find_instruction(program, target);
+        if (destination == NULL) {
+            return false;
+        }
+        destination->target = true;
+    }
+    return true;
+}
+
+// marks where the live loops land; a deleted target hands its mark to the next live instruction
+static void mark_targets(struct program *program)
+{
+    for (size_t i = 0; i < program->count; i++) {
+        program->code[i].target = false;
+    }
+    for (size_t i = 0; i < program->count; i++) {
+        const struct instruction *ins = &program->code[i];
+        if (ins->deleted || ins->opcode != 8 || ins->operands[0] < 0) {
+            continue;
+        }
+        struct instruction *destination = resolve(program, ins->operands[0]);
+        if (destination != NULL) {
+            destination->target = true;
+        }
+    }
+}
+
+static void delete(struct instruction *ins, bool *changed)
+{
+    ins->deleted = true;
+    *changed = true;
+}
+
+static void rewrite_movr(struct instruction *ins, int32_t reg, int32_t value, bool *changed)
+{
+    ins->opcode = 9;
+    ins->operands[0] = reg;
+    ins->operands[1] = value;
+    *changed = true;
+}
+
+// forward pass: constant propagation and folding
+static bool propagate(struct program *program)
+{
+    bool changed = false;
+    mark_targets(program);
+
+    // all registers start at zero unless something jumps back to the start
+    struct knowledge facts;
+    for (int reg = REGISTER_A; reg <= REGISTER_D; reg++) {
+        facts.known[reg] = true;
+        facts.value[reg] = 0;
+    }
+
+    for (size_t i = 0; i < program->count; i++) {
+        struct instruction *ins = &program->code[i];
+        if (ins->deleted) {
+            continue;
+        }
+        if (ins->target) {
+            memset(facts.known, 0, sizeof(facts.known));
+        }
+        if (!has_valid_operands(ins)) {
+            continue;
+        }
+
+        int32_t reg = ins->operands[0];
+        switch (ins->opcode) {
+            case 0:
+                break;
+            case 2:
+            case 3:
+            case 4:
+            case 6:
+            case 7: {
+                int32_t target = ins->opcode >= 6 ? reg : REGISTER_A;
+                if (ins->opcode < 6 && facts.known[reg] && !facts.known[REGISTER_A]) {
+
+                    // adding or subtracting 0 and multiplying by 1 change nothing
+                    int32_t neutral = ins->opcode == 4 ? 1 : 0;
+                    if (facts.value[reg] == neutral) {
+                        delete(ins, &changed);
+                    }
+                    break;
+                }
+                if (!facts.known[target] || !facts.known[reg]) {
+                    facts.known[target] = false;
+                    break;
+                }
+
+                uint32_t old = facts.value[target];
+                uint32_t operand = facts.value[reg];
+                uint32_t result = ins->opcode == 2 ? old + operand
+                    : ins->opcode == 3 ? old - operand
+                    : ins->opcode == 4 ? old * operand
+                    : ins->opcode == 6 ? old + 1 : old - 1;
+                if (result == old) {
+                    delete(ins, &changed);
+                } else {
+                    rewrite_movr(ins, target, (int32_t) result, &changed);
+                }
+                facts.value[target] = (int32_t) result;
+                break;
+            }
+            case 8:
+                // a loop never taken is dead, one falling through leaves C at 0
+                if (facts.known[REGISTER_C] && facts.value[REGISTER_C] == 0) {
+                    delete(ins, &changed);
+                }
+                facts.known[REGISTER_C] = true;
+                facts.value[REGISTER_C] = 0;
+                break;
+            case 9:
+                if (facts.known[reg] && facts.value[reg] == ins->operands[1]) {
+                    delete(ins, &changed);
+                }
+                facts.known[reg] = true;
+                facts.value[reg] = ins->operands[1];
+                break;
+            case 16: {
+                int32_t other = ins->operands[1];
+                if (reg == other) {
+                    delete(ins, &changed);
+                    break;
+                }
+                bool known = facts.known[reg];
+                int32_t value = facts.value[reg];
+                facts.known[reg] = facts.known[other];
+                facts.value[reg] = facts.value[other];
+                facts.known[other] = known;
+                facts.value[other] = value;
+                break;
+            }
+            default: {
+                int clobbered = clobbered_registers(ins);
+                for (int r = REGISTER_A; r <= REGISTER_D; r++) {
+                    if (clobbered & (1 << r)) {
+                        facts.known[r] = false;
+                    }
+                }
+                break;
+            }
+        }
+    }
+    return changed;
+}
+
+// pairs of neighbouring instructions that cancel out
+static bool peephole(struct program *program)
+{
+    bool changed = false;
+    struct instruction *previous = NULL;
+    mark_targets(program);
+
+    for (size_t i = 0; i < program->count; i++) {
+        struct instruction *ins = &program->code[i];
+        if (ins->deleted) {
+            continue;
+        }
+
+        // the second half can't go when something jumps right to it
+        if (previous != NULL && !ins->target && has_valid_operands(ins) && has_valid_operands(previous)) {
+            bool inc_dec = ((previous->opcode == 6 && ins->opcode == 7) || (previous->opcode == 7 && ins->opcode == 6))
+                && previous->operands[0] == ins->operands[0];
+            bool swaps = previous->opcode == 16 && ins->opcode == 16
+                && ((previous->operands[0] == ins->operands[0] && previous->operands[1] == ins->operands[1])
+                    || (previous->operands[0] == ins->operands[1] && previous->operands[1] == ins->operands[0]));
+            if (inc_dec || swaps) {
+                delete(previous, &changed);
+                delete(ins, &changed);
+                previous = NULL;
+                continue;
+            }
+        }
+        previous = ins;
+    }
+    return changed;
+}
+
+// backward pass: register writes nobody reads before the next overwrite
+static bool eliminate_dead(struct program *program)
+{
+    bool changed = false;
+
+    // everything is visible when the program stops, faults or jumps
+    int live = ALL_REGISTERS;
+    for (size_t i = program->count; i-- > 0;) {
+        struct instruction *ins = &program->code[i];
+        if (ins->deleted) {
+            continue;
+        }
+        if (!is_pure(ins) || !has_valid_operands(ins)) {
+            live = ALL_REGISTERS;
+            continue;
+        }
+
+        int reads;
+        int writes;
+        register_sets(ins, &reads, &writes);
+        if ((writes & live) == 0) {
+            delete(ins, &changed);
+            continue;
+        }
+        live = (live & ~writes) | reads;
+    }
+    return changed;
+}
+
+static bool eliminate_unreachable(struct program *program)
+{
+    bool changed = false;
+    bool *reached = calloc(program->count + 1, sizeof(bool));
+    size_t *work = malloc((program->count + 1) * sizeof(size_t));
+    size_t pending = 0;
+    if (reached == NULL || work == NULL) {
+        free(reached);
+        free(work);
+        return false;
+    }
+
+    struct instruction *start = resolve(program, 0);
+    if (start != NULL) {
+        reached[start - program->code] = true;
+        work[pending++] = start - program->code;
+    }
+
+    // follow fall through and loop edges from the start
+    while (pending > 0) {
+        struct instruction *ins = &program->code[work[--pending]];
+        struct instruction *next[2] = { NULL, NULL };
+        bool stops = ins->opcode == 1 || ins->opcode < 0 || ins->opcode >= CPU_OPCODE_COUNT;
+        if (!stops) {
+            next[0] = resolve(program, ins->index + 1);
+        }
+        if (ins->opcode == 8 && ins->operands[0] >= 0) {
+            next[1] = resolve(program, ins->operands[0]);
+        }
+        for (int k = 0; k < 2; k++) {
+            if (next[k] != NULL && !reached[next[k] - program->code]) {
+                reached[next[k] - program->code] = true;
+                work[pending++] = next[k] - program->code;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < program->count; i++) {
+        if (!program->code[i].deleted && !reached[i]) {
+            delete(&program->code[i], &changed);
+        }
+    }
+
+    free(reached);
+    free(work);
+    return changed;
+}
+
+static bool write_word(FILE *out, int32_t value)
+{
+    uint32_t word = (uint32_t) value;
+    unsigned char bytes[4] = { word & 0xff, (word >> 8) & 0xff, (word >> 16) & 0xff, word >> 24 };
+    return fwrite(bytes, 1, 4, out) == 4;
+}
+
+static bool write_program(FILE *out, struct program *program, size_t *count, size_t *words)
+{
+    // new position of every instruction
+    int32_t *position = malloc((program->count + 1) * sizeof(int32_t));
+    if (position == NULL) {
+        return false;
+    }
+    int32_t length = 0;
+    *count = 0;
+    for (size_t i = 0; i < program->count; i++) {
+        position[i] = length;
+        if (!program->code[i].deleted) {
+            length += cpu_instruction_length(program->code[i].opcode);
+            (*count)++;
+        }
+    }
+    *words = length;
+
+    for (size_t i = 0; i < program->count; i++) {
+        const struct instruction *ins = &program->code[i];
+        if (ins->deleted) {
+            continue;
+        }
+
+        int32_t buffer[3] = { ins->opcode, ins->operands[0], ins->operands[1] };
+
+        // relocate jumps, anything past the program still lands past it
+        if (ins->opcode == 8 && ins->operands[0] >= 0) {
+            struct instruction *target = resolve(program, ins->operands[0]);
+            buffer[1] = target != NULL ? position[target - program->code] : length;
+        }
+
+        for (int k = 0; k < cpu_instruction_length(ins->opcode); k++) {
+            if (!write_word(out, buffer[k])) {
+                free(position);
+                return false;
+            }
+        }
+    }
+
+    free(position);
+    return true;
+}
+
+static void usage(void)
+{
+    printf("Invalid arguments, run ./cpuopt FILE OUTPUT\n");
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    FILE *fptr;
+    if ((fptr = fopen(argv[1], "rb")) == NULL) {
+        perror(argv[1]);
+        return EXIT_FAILURE;
+    }
+    struct program program;
+    bool loaded = read_program(fptr, &program);
+    fclose(fptr);
+    if (!loaded) {
+        fprintf(stderr, "%s: not a valid program\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    // programs jumping into the middle of instructions are copied unchanged
+    size_t input_count = program.count;
+    bool optimize = can_optimize(&program);
+    if (optimize) {
+        bool changed = true;
+        while (changed) {
+            changed = propagate(&program);
+            changed |= peephole(&program);
+            changed |= eliminate_dead(&program);
+            changed |= eliminate_unreachable(&program);
+        }
+    } else {
+        fprintf(stderr, "%s: jumps into an instruction, left unchanged\n", argv[1]);
+    }
+
+    FILE *out = fopen(argv[2], "wb");
+    if (out == NULL) {
+        perror(argv[2]);
+        free(program.memory);
+        free(program.code);
+        return EXIT_FAILURE;
+    }
+    size_t count = input_count;
+    size_t words = program.words;
+    bool written = true;
+    if (optimize) {
+        written = write_program(out, &program, &count, &words);
+    } else {
+        for (size_t i = 0; written && i < program.words; i++) {
+            written = write_word(out, program.memory[i]);
+        }
+    }
+    free(program.memory);
+    free(program.code);
+    if (fclose(out) != 0 || !written) {
+        perror(argv[2]);
+        return EXIT_FAILURE;
+    }
+
+    fprintf(stderr, "%zu -> %zu instructions, %zu -> %zu words\n", input_count, count, program.words, words);
+    return EXIT_SUCCESS;
+}
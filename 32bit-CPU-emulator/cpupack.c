@@ -0,0 +1,243 @@
+#include "cpu_image.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+struct buffer {
+    unsigned char *data;
+    size_t size;
+    size_t capacity;
+};
+
+static bool append(struct buffer *buffer, const void *data, size_t size)
+{
+    if (buffer->size + size > buffer->capacity) {
+        size_t capacity = buffer->capacity == 0 ? 4096 : buffer->capacity;
+        while (capacity < buffer->size + size) {
+            capacity *= 2;
+        }
+        unsigned char *new_data = realloc(buffer->data, capacity);
+        if (new_data == NULL) {
+            return false;
+        }
+        buffer->data = new_data;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+    return true;
+}
+
+static bool read_file(const char *path, struct buffer *buffer)
+{
+    FILE *fptr = fopen(path, "rb");
+    if (fptr == NULL) {
+        return false;
+    }
+
+    unsigned char chunk[4096];
+    size_t got;
+    bool ok = true;
+    while (ok && (got = fread(chunk, 1, sizeof(chunk), fptr)) > 0) {
+        ok = append(buffer, chunk, got);
+    }
+    ok = ok && !ferror(fptr);
+    fclose(fptr);
+    return ok;
+}
+
+// turns `name index` lines into symbol records, `;` starts a comment
+static bool read_symbols(const char *path, struct buffer *symbols)
+{
+    FILE *fptr = fopen(path, "r");
+    if (fptr == NULL) {
+        return false;
+    }
+
+    char line[256];
+    int line_number = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), fptr) != NULL) {
+        line_number++;
+        char *comment = strchr(line, ';');
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+
+        char name[128];
+        long index;
+        int fields = sscanf(line, "%127s %ld", name, &index);
+        if (fields <= 0) {
+            continue;
+        }
+        if (fields != 2 || index < 0 || index > INT32_MAX) {
+            fprintf(stderr, "%s:%d: expected `name index`\n", path, line_number);
+            errno = EINVAL;
+            ok = false;
+            break;
+        }
+
+        uint32_t record[2] = { (uint32_t) index, (uint32_t) strlen(name) };
+        static const char padding[4] = { 0 };
+        ok = append(symbols, record, sizeof(record)) && append(symbols, name, record[1])
+            && append(symbols, padding, (4 - record[1] % 4) % 4);
+    }
+    fclose(fptr);
+    return ok;
+}
+
+static bool write_section(FILE *out, struct cpu_image_header *header, uint32_t kind,
+    const struct buffer *data, uint64_t *offset)
+{
+    static const unsigned char zeros[CPU_IMAGE_ALIGN] = { 0 };
+    struct cpu_image_section *section = &header->sections[header->section_count++];
+    section->kind = kind;
+    section->checksum = cpu_image_checksum(data->data, data->size);
+    section->offset = *offset;
+    section->size = data->size;
+
+    // every section is padded up to the alignment
+    size_t padding = (CPU_IMAGE_ALIGN - data->size % CPU_IMAGE_ALIGN) % CPU_IMAGE_ALIGN;
+    if (fseek(out, *offset, SEEK_SET) != 0 || fwrite(data->data, 1, data->size, out) != data->size
+        || fwrite(zeros, 1, padding, out) != padding) {
+        return false;
+    }
+    *offset += data->size + padding;
+    return true;
+}
+
+static void usage(void)
+{
+    printf("Invalid arguments, run ./cpupack [-e ENTRY] [-s STACK] [-y SYMBOLS] FILE OUTPUT\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *entry = NULL;
+    const char *symbols_path = NULL;
+    long stack_capacity = 0;
+    int option;
+    while ((option = getopt(argc, argv, "e:s:y:")) != -1) {
+        char *end;
+        switch (option) {
+            case 'e':
+                entry = optarg;
+                break;
+            case 's':
+                stack_capacity = strtol(optarg, &end, 10);
+                if (*end != '\0' || stack_capacity < 0 || stack_capacity > INT32_MAX) {
+                    printf("Invalid stack capacity\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'y':
+                symbols_path = optarg;
+                break;
+            default:
+                usage();
+                return EXIT_FAILURE;
+        }
+    }
+    if (argc - optind != 2) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    struct buffer program = { NULL, 0, 0 };
+    struct buffer symbols = { NULL, 0, 0 };
+    if (!read_file(argv[optind], &program)) {
+        perror(argv[optind]);
+        return EXIT_FAILURE;
+    }
+    if (program.size % 4 != 0) {
+        fprintf(stderr, "%s: not a valid program\n", argv[optind]);
+        return EXIT_FAILURE;
+    }
+    if (symbols_path != NULL && !read_symbols(symbols_path, &symbols)) {
+        perror(symbols_path);
+        return EXIT_FAILURE;
+    }
+
+    struct cpu_image_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CPU_IMAGE_MAGIC, 4);
+    header.version = CPU_IMAGE_VERSION;
+    header.stack_capacity = stack_capacity;
+
+    // the entry is an instruction index, or a symbol looked up in the written image
+    bool symbolic = false;
+    if (entry != NULL) {
+        char *end;
+        long index = strtol(entry, &end, 10);
+        if (*end == '\0' && index >= 0 && (size_t) index < program.size / 4) {
+            header.entry = index;
+        } else if (*end != '\0' && symbols_path != NULL) {
+            symbolic = true;
+        } else {
+            fprintf(stderr, "%s: invalid entry\n", entry);
+            return EXIT_FAILURE;
+        }
+    }
+
+    FILE *out = fopen(argv[optind + 1], "w+b");
+    if (out == NULL) {
+        perror(argv[optind + 1]);
+        return EXIT_FAILURE;
+    }
+
+    uint64_t offset = CPU_IMAGE_ALIGN;
+    bool ok = write_section(out, &header, CPU_IMAGE_PROGRAM, &program, &offset);
+    if (ok && symbols_path != NULL) {
+        ok = write_section(out, &header, CPU_IMAGE_SYMBOLS, &symbols, &offset);
+    }
+    ok = ok && fseek(out, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, out) == 1 && fflush(out) == 0;
+    if (!ok) {
+        perror(argv[optind + 1]);
+        fclose(out);
+        return EXIT_FAILURE;
+    }
+
+    struct cpu_image image;
+    int32_t index;
+    if (symbolic) {
+        if (!cpu_image_open(&image, fileno(out)) || !cpu_image_find_symbol(&image, entry, &index)
+            || index < 0 || (size_t) index >= program.size / 4) {
+            fprintf(stderr, "%s: invalid entry\n", entry);
+            fclose(out);
+            unlink(argv[optind + 1]);
+            return EXIT_FAILURE;
+        }
+        header.entry = index;
+        ok = fseek(out, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, out) == 1 && fflush(out) == 0;
+    }
+
+    // check the finished image the way the loader will
+    int32_t *stack_bottom;
+    size_t mapped_size;
+    int32_t *memory = NULL;
+    if (ok && cpu_image_open(&image, fileno(out))
+        && (memory = cpu_image_map(&image, header.stack_capacity, &stack_bottom, &mapped_size)) != NULL) {
+        if (!cpu_image_verify(&image, memory)) {
+            fprintf(stderr, "%u: entry is not the start of an instruction\n", header.entry);
+            ok = false;
+        }
+        munmap(memory, mapped_size);
+    } else {
+        ok = false;
+    }
+    if (fclose(out) != 0 || !ok) {
+        if (memory == NULL) {
+            perror(argv[optind + 1]);
+        }
+        unlink(argv[optind + 1]);
+        return EXIT_FAILURE;
+    }
+
+    free(program.data);
+    free(symbols.data);
+    return EXIT_SUCCESS;
+}
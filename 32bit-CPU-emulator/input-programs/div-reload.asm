@@ -0,0 +1,6 @@
+movr A 10     ; Dividend
+movr B 2      ; Divisor
+div B         ; A = A / B
+movr A 10     ; Reload A, the division changed it
+out A         ; Output 10
+halt
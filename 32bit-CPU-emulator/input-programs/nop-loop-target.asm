@@ -0,0 +1,9 @@
+movr C 3      ; Loop counter
+movr A 0      ; Clear A
+loop_start:
+nop           ; Loop target the optimizer removes
+inc A         ; A = A + 1
+dec C
+loop loop_start ; Decrement C, jump to loop_start if C != 0
+out A         ; Output 3
+halt
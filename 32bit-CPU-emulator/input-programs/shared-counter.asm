@@ -0,0 +1,19 @@
+; run with ./cpu smp CORES: every core adds 1000 to shared[0]
+movr C 1000       ; iterations left
+next:
+push C            ; save the counter, C is needed for the retry check
+retry:
+lds A 0           ; A = current value
+swap A B
+movr A 1
+add B             ; A = value + 1
+swap A B          ; A = value, B = value + 1
+cas B 0           ; shared[0] = B if it still holds A, A = value found
+inc A
+sub B             ; A = found - value, zero on success
+swap A C
+loop retry        ; somebody else was faster, try again
+pop C
+dec C
+loop next
+halt
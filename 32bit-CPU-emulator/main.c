@@ -1,11 +1,21 @@
 #include "cpu.h"
+#include "cpu_image.h"
+#include "cpu_native.h"
+#include "cpu_serve.h"
 #include <assert.h>
+#include <ctype.h>
+#include <dlfcn.h>
 #include <errno.h>
 #include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+
+// shared memory size and core limit of the smp mode
+#define SMP_SHARED_WORDS 4096
+#define SMP_MAX_CORES 256
 
 const char *status_name(enum cpu_status status)
 {
@@ -26,6 +36,10 @@ const char *status_name(enum cpu_status status)
         return "CPU_DIV_BY_ZERO";
     case CPU_IO_ERROR:
         return "CPU_IO_ERROR";
+    case CPU_BREAKPOINT:
+        return "CPU_BREAKPOINT";
+    case CPU_WATCHPOINT:
+        return "CPU_WATCHPOINT";
     default:
         fprintf(stderr, "BUG: Unknown status (%d)\n", status);
         abort();
@@ -42,78 +56,455 @@ static void state(struct cpu *cpu)
     printf("Stack size: %d\n", cpu_get_stack_size(cpu));
 }
 
+// prints why the cpu stopped, returns false once the program is over
+static bool report_stop(struct cpu *cpu)
+{
+    enum cpu_watch_kind kind;
+    int32_t where;
+    enum cpu_status status = cpu_get_status(cpu);
+    if (status == CPU_BREAKPOINT) {
+        printf("Breakpoint at %d\n", cpu_get_next_instruction(cpu));
+    } else if (cpu_get_watchpoint_hit(cpu, &kind, &where)) {
+        if (kind == CPU_WATCH_REGISTER) {
+            printf("Watchpoint on register %c\n", 'A' + where);
+        } else {
+            printf("Watchpoint on stack slot %d\n", where);
+        }
+    }
+    state(cpu);
+
+    if (status == CPU_OK || status == CPU_BREAKPOINT || status == CPU_WATCHPOINT) {
+        return true;
+    }
+    printf("finished\n");
+    return false;
+}
+
+// `A` to `D` name a register, `sN` the N-th stack slot from the bottom
+static bool parse_watch(const char *arg, enum cpu_watch_kind *kind, int32_t *where)
+{
+    if (arg[0] != '\0' && strchr("ABCDabcd", arg[0]) != NULL && (arg[1] == '\0' || isspace(arg[1]))) {
+        *kind = CPU_WATCH_REGISTER;
+        *where = toupper(arg[0]) - 'A';
+        return true;
+    }
+
+    char *end;
+    long slot = strtol(arg + 1, &end, 10);
+    if (arg[0] != 's' || end == arg + 1 || (*end != '\0' && !isspace(*end)) || slot < 0 || slot > INT32_MAX) {
+        return false;
+    }
+    *kind = CPU_WATCH_STACK;
+    *where = slot;
+    return true;
+}
+
+// an instruction index, or a name from the symbol table of a program image
+static bool parse_breakpoint(const char *path, char *arg, int32_t *index)
+{
+    char *end;
+    long number = strtol(arg, &end, 10);
+    if (end != arg) {
+        *index = number;
+        return number >= 0 && number <= INT32_MAX;
+    }
+
+    arg[strcspn(arg, " \t\r\n")] = '\0';
+    FILE *fptr = fopen(path, "rb");
+    if (fptr == NULL) {
+        return false;
+    }
+    char magic[4];
+    struct cpu_image image;
+    bool found = fread(magic, 1, 4, fptr) == 4 && memcmp(magic, CPU_IMAGE_MAGIC, 4) == 0
+        && cpu_image_open(&image, fileno(fptr)) && cpu_image_find_symbol(&image, arg, index);
+    fclose(fptr);
+    return found;
+}
+
+static void trace(struct cpu *cp, const char *path)
+{
+    printf("Press Enter to execute the next instruction or type 'q' to quit.\n");
+    printf("'c' runs until a breakpoint or a watchpoint, 'b INDEX' or 'b SYMBOL' breaks at an instruction,\n");
+    printf("'w A' to 'w D' and 'w sSLOT' watch a register or a stack slot, 'd INDEX' and 'u A' or 'u sSLOT' remove them.\n");
+
+    char line[128];
+    while (fgets(line, sizeof(line), stdin) != NULL) {
+        char *arg = line + 1;
+        while (isspace(*arg)) {
+            arg++;
+        }
+
+        if (line[0] == '\n') {
+            cpu_step(cp);
+            if (!report_stop(cp)) {
+                break;
+            }
+        } else if (line[0] == 'c') {
+            cpu_run(cp, INT_MAX);
+            if (!report_stop(cp)) {
+                break;
+            }
+        } else if (line[0] == 'b' || line[0] == 'd') {
+            int32_t index;
+            bool valid = parse_breakpoint(path, arg, &index);
+            if (!valid || !(line[0] == 'b' ? cpu_set_breakpoint(cp, index) : cpu_clear_breakpoint(cp, index))) {
+                printf("Invalid breakpoint\n");
+            }
+        } else if (line[0] == 'w' || line[0] == 'u') {
+            enum cpu_watch_kind kind;
+            int32_t where;
+            bool valid = parse_watch(arg, &kind, &where);
+            if (!valid || !(line[0] == 'w' ? cpu_set_watchpoint(cp, kind, where) : cpu_clear_watchpoint(cp, kind, where))) {
+                printf("Invalid watchpoint\n");
+            }
+        } else if (line[0] == 'q') {
+            break;
+        }
+    }
+}
+
 static void usage(void)
 {
     printf("Invalid arguments, run ./cpu (run|trace) [stack_capacity] FILE\n");
+    printf("                    or ./cpu serve [stack_capacity] SOCKET FILE...\n");
+    printf("                    or ./cpu call SOCKET PROGRAM\n");
+    printf("                    or ./cpu smp CORES [stack_capacity] FILE\n");
 }
 
-int main(int argc, char *argv[])
+static bool parse_stack_capacity(const char *arg, size_t *stack_capacity)
 {
-    if (argc > 4 || argc < 3) {
+    char *end;
+    errno = 0;
+    *stack_capacity = (size_t) strtol(arg, &end, 10);
+    if (*end != '\0') {
+        printf("Invalid stack capacity\n");
+        return false;
+    }
+    if (errno == ERANGE) {
+        printf("Stack capacity out of range\n");
+        return false;
+    }
+    return true;
+}
+
+static int serve_main(int argc, char *argv[])
+{
+    if (argc < 4) {
         usage();
         return EXIT_FAILURE;
     }
 
+    // a numeric first argument is the stack capacity
     size_t stack_capacity = 256;
-    if (argc == 4) {
-        char *end;
-        stack_capacity = (size_t) strtol(argv[2], &end, 10);
-        if (*end != '\0') {
-            printf("Invalid stack capacity\n");
+    int first = 2;
+    if (argc >= 5 && argv[2][0] != '\0' && strspn(argv[2], "0123456789") == strlen(argv[2])) {
+        if (!parse_stack_capacity(argv[2], &stack_capacity)) {
             return EXIT_FAILURE;
         }
-        if (errno == ERANGE) {
-            printf("Stack capacity out of range\n");
-            return EXIT_FAILURE;
+        first = 3;
+    }
+
+    return cpu_serve(argv[first], stack_capacity, first == 3, argv + first + 1, argc - first - 1);
+}
+
+static int call_main(int argc, char *argv[])
+{
+    if (argc != 4) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    char *end;
+    struct cpu_serve_request request;
+    request.program = (uint32_t) strtoul(argv[3], &end, 10);
+    request.steps = INT_MAX;
+    if (*end != '\0') {
+        printf("Invalid program\n");
+        return EXIT_FAILURE;
+    }
+
+    // the whole stdin becomes the guest input
+    size_t capacity = 4096;
+    size_t length = 0;
+    char *input = malloc(capacity);
+    while (input != NULL && (length += fread(input + length, 1, capacity - length, stdin)) == capacity) {
+        char *new_input = realloc(input, capacity * 2);
+        if (new_input == NULL) {
+            free(input);
         }
+        input = new_input;
+        capacity *= 2;
     }
+    if (input == NULL || length > CPU_SERVE_MAX_INPUT) {
+        fprintf(stderr, "Memory failure");
+        free(input);
+        return EXIT_FAILURE;
+    }
+    request.input_size = length;
 
-    FILE *fptr;
-    if ((fptr = fopen(argv[argc - 1], "rb")) == NULL) {
-        perror(argv[argc - 1]);
+    struct cpu_serve_response response;
+    int result = cpu_serve_call(argv[2], &request, input, &response, stdout);
+    free(input);
+    if (result != 0) {
+        perror(argv[2]);
         return EXIT_FAILURE;
     }
+    if (response.error != CPU_SERVE_OK) {
+        fprintf(stderr, "serve error %u\n", response.error);
+        return EXIT_FAILURE;
+    }
+
+    printf("A: %d, B: %d, C: %d, D: %d\n", response.registers[REGISTER_A],
+        response.registers[REGISTER_B], response.registers[REGISTER_C],
+        response.registers[REGISTER_D]);
+    printf("Stack size: %d\n", response.stack_size);
+    printf("\'cpu_run\' result: %d\n", (int) response.result);
+    return EXIT_SUCCESS;
+}
+
+static bool is_native(const char *path)
+{
+    size_t length = strlen(path);
+    return length > 3 && strcmp(path + length - 3, ".so") == 0;
+}
+
+static void *open_native(const char *path, cpu_native_entry *entry, const unsigned char **image, size_t *image_size)
+{
+    // dlopen only searches the library path for names without a slash
+    char *name = malloc(strlen(path) + 3);
+    if (name == NULL) {
+        return NULL;
+    }
+    sprintf(name, "%s%s", strchr(path, '/') == NULL ? "./" : "", path);
+
+    void *handle = dlopen(name, RTLD_NOW | RTLD_LOCAL);
+    free(name);
+    if (handle == NULL) {
+        fprintf(stderr, "%s\n", dlerror());
+        return NULL;
+    }
+
+    const unsigned *abi = dlsym(handle, CPU_NATIVE_ABI_SYMBOL);
+    const unsigned char *bytes = dlsym(handle, CPU_NATIVE_IMAGE_SYMBOL);
+    const size_t *size = dlsym(handle, CPU_NATIVE_IMAGE_SIZE_SYMBOL);
+    *(void **) entry = dlsym(handle, CPU_NATIVE_RUN_SYMBOL);
+    if (abi == NULL || bytes == NULL || size == NULL || *entry == NULL || *abi != CPU_NATIVE_ABI) {
+        fprintf(stderr, "%s: not a program translated by this version of cpu2c\n", path);
+        dlclose(handle);
+        return NULL;
+    }
+
+    // the translated program carries its own image for the stack and the interpreter
+    *image = bytes;
+    *image_size = *size;
+    return handle;
+}
+
+static struct cpu *load_image(FILE *fptr, const char *path, size_t stack_capacity, bool capacity_given)
+{
+    struct cpu_image image;
+    if (!cpu_image_open(&image, fileno(fptr))) {
+        perror(path);
+        return NULL;
+    }
+
+    // the image recommends a stack capacity unless one was given
+    if (!capacity_given && image.header.stack_capacity != 0) {
+        stack_capacity = image.header.stack_capacity;
+    }
+
     int32_t *stack_ptr;
-    int32_t *memory = cpu_create_memory(fptr, stack_capacity, &stack_ptr);
+    size_t mapped_size;
+    int32_t *memory = cpu_image_map(&image, stack_capacity, &stack_ptr, &mapped_size);
     if (memory == NULL) {
+        perror(path);
+        return NULL;
+    }
+    if (!cpu_image_verify(&image, memory)) {
+        perror(path);
+        munmap(memory, mapped_size);
+        return NULL;
+    }
+
+    struct cpu *cp = cpu_create_mapped(memory, mapped_size, stack_ptr, stack_capacity);
+    if (cp == NULL) {
         fprintf(stderr, "Memory failure");
+        munmap(memory, mapped_size);
+        return NULL;
+    }
+    cpu_set_entry(cp, image.header.entry);
+    return cp;
+}
+
+// loads a raw program, a program image or a translated program
+static struct cpu *load(const char *path, size_t stack_capacity, bool capacity_given,
+    void **native, cpu_native_entry *entry)
+{
+    FILE *fptr;
+    int32_t *stack_ptr;
+    int32_t *memory;
+    if (is_native(path)) {
+        const unsigned char *image;
+        size_t image_size;
+        if ((*native = open_native(path, entry, &image, &image_size)) == NULL) {
+            return NULL;
+        }
+        memory = cpu_create_memory_from_buffer(image, image_size, stack_capacity, &stack_ptr);
+    } else if ((fptr = fopen(path, "rb")) == NULL) {
+        perror(path);
+        return NULL;
+    } else {
+
+        // program images are recognized by their magic, anything else is raw
+        char magic[4];
+        if (fread(magic, 1, 4, fptr) == 4 && memcmp(magic, CPU_IMAGE_MAGIC, 4) == 0) {
+            struct cpu *cp = load_image(fptr, path, stack_capacity, capacity_given);
+            fclose(fptr);
+            return cp;
+        }
+        rewind(fptr);
+        memory = cpu_create_memory(fptr, stack_capacity, &stack_ptr);
         fclose(fptr);
-        return EXIT_FAILURE;
+    }
+
+    if (memory == NULL) {
+        fprintf(stderr, "Memory failure");
+        if (*native != NULL) {
+            dlclose(*native);
+        }
+        return NULL;
     }
 
     struct cpu *cp = cpu_create(memory, stack_ptr, stack_capacity);
     if (cp == NULL) {
         fprintf(stderr, "Memory failure");
         free(memory);
-        fclose(fptr);
+        if (*native != NULL) {
+            dlclose(*native);
+        }
+        return NULL;
+    }
+    return cp;
+}
+
+static int smp_main(int argc, char *argv[])
+{
+    if (argc < 4 || argc > 5) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    char *end;
+    long count = strtol(argv[2], &end, 10);
+    if (*end != '\0' || count < 1 || count > SMP_MAX_CORES) {
+        printf("Invalid number of cores\n");
+        return EXIT_FAILURE;
+    }
+
+    size_t stack_capacity = 256;
+    if (argc == 5 && !parse_stack_capacity(argv[3], &stack_capacity)) {
+        return EXIT_FAILURE;
+    }
+
+    int32_t *shared = calloc(SMP_SHARED_WORDS, sizeof(int32_t));
+    struct cpu **cores = calloc(count, sizeof(struct cpu *));
+    long long *results = calloc(count, sizeof(long long));
+    int result = EXIT_FAILURE;
+    if (shared == NULL || cores == NULL || results == NULL) {
+        fprintf(stderr, "Memory failure");
+        goto cleanup;
+    }
+
+    // every core gets its own copy of the program and its own stack
+    for (long i = 0; i < count; i++) {
+        void *native = NULL;
+        cpu_native_entry entry = NULL;
+        if ((cores[i] = load(argv[argc - 1], stack_capacity, argc == 5, &native, &entry)) == NULL) {
+            goto cleanup;
+        }
+
+        // translated programs run on the interpreter, their image is already copied
+        if (native != NULL) {
+            dlclose(native);
+        }
+        cpu_attach_shared(cores[i], shared, SMP_SHARED_WORDS, i);
+    }
+
+    if (!cpu_run_smp(cores, count, INT_MAX, results)) {
+        fprintf(stderr, "Failed to start the cores\n");
+        goto cleanup;
+    }
+
+    for (long i = 0; i < count; i++) {
+        printf("Core %ld\n", i);
+        state(cores[i]);
+        printf("\'cpu_run\' result: %d\n", (int) results[i]);
+    }
+    printf("Shared: %d, %d, %d, %d\n", shared[0], shared[1], shared[2], shared[3]);
+    result = EXIT_SUCCESS;
+
+cleanup:
+    for (long i = 0; cores != NULL && i < count; i++) {
+        if (cores[i] != NULL) {
+            cpu_destroy(cores[i]);
+            free(cores[i]);
+        }
+    }
+    free(cores);
+    free(results);
+    free(shared);
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc >= 2 && strcmp(argv[1], "serve") == 0) {
+        return serve_main(argc, argv);
+    }
+    if (argc >= 2 && strcmp(argv[1], "call") == 0) {
+        return call_main(argc, argv);
+    }
+    if (argc >= 2 && strcmp(argv[1], "smp") == 0) {
+        return smp_main(argc, argv);
+    }
+
+    if (argc > 4 || argc < 3) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    size_t stack_capacity = 256;
+    if (argc == 4 && !parse_stack_capacity(argv[2], &stack_capacity)) {
+        return EXIT_FAILURE;
+    }
+
+    void *native = NULL;
+    cpu_native_entry entry = NULL;
+    struct cpu *cp = load(argv[argc - 1], stack_capacity, argc == 4, &native, &entry);
+    if (cp == NULL) {
         return EXIT_FAILURE;
     }
 
     if (strcmp(argv[1], "run") == 0) {
-        int run_result = cpu_run(cp, INT_MAX);
+        int run_result;
+        if (native != NULL) {
+            run_result = cpu_run_native(cp, entry, INT_MAX);
+        } else {
+            run_result = cpu_run(cp, INT_MAX);
+        }
         state(cp);
         printf("\'cpu_run\' result: %d\n", run_result);
     } else if (strcmp(argv[1], "trace") == 0) {
-        printf("Press Enter to execute the next instruction or type 'q' to quit.\n");
-        while (true) {
-            int c;
-            if ((c = getchar()) == '\n') {
-                if (cpu_step(cp) == 0) {
-                    state(cp);
-                    printf("finished\n");
-                    break;
-                }
-                state(cp);
-            } else if (c == 'q') {
-                break;
-            }
-        }
+        trace(cp, argv[argc - 1]);
     } else {
         usage();
     }
 
-    fclose(fptr);
     cpu_destroy(cp);
     free(cp);
+    if (native != NULL) {
+        dlclose(native);
+    }
     return EXIT_SUCCESS;
 }
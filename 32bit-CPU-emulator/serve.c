@@ -0,0 +1,443 @@
+#include "cpu.h"
+#include "cpu_image.h"
+#include "cpu_serve.h"
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// the words of a loaded program and its pool of warm cpus
+struct program {
+    unsigned char *image;
+    size_t image_size;
+    size_t stack_capacity;
+    int32_t entry;
+    pthread_mutex_t lock;
+    struct cpu **pool;
+    size_t pooled;
+    size_t pool_capacity;
+};
+
+struct connection {
+    struct program *programs;
+    size_t count;
+    int fd;
+};
+
+// ------ tool functions
+static int read_all(int fd, void *buffer, size_t size);
+static int write_all(int fd, const void *buffer, size_t size);
+static unsigned char *read_image(FILE *fptr, size_t *size);
+static int unpack_image(struct program *program, int fd, bool capacity_given);
+static int load_program(struct program *program, const char *path, bool capacity_given);
+static struct cpu *program_acquire(struct program *program);
+static void program_release(struct program *program, struct cpu *cpu);
+static void serve_request(struct program *program, const struct cpu_serve_request *request,
+    unsigned char *input, struct cpu_serve_response *response, char **output);
+static void *serve_connection(void *arg);
+
+int cpu_serve(const char *socket_path, size_t stack_capacity, bool capacity_given, char *const paths[], size_t count)
+{
+    // check if the parameters are NULL
+    assert(socket_path != NULL);
+    assert(paths != NULL);
+
+    // clients hanging up must not kill the daemon
+    signal(SIGPIPE, SIG_IGN);
+
+    struct program *programs = calloc(count, sizeof(struct program));
+    if (programs == NULL) {
+        fprintf(stderr, "Memory failure");
+        return EXIT_FAILURE;
+    }
+
+    // load every program once and warm one cpu for it
+    for (size_t i = 0; i < count; i++) {
+        programs[i].stack_capacity = stack_capacity;
+        pthread_mutex_init(&programs[i].lock, NULL);
+        if (!load_program(&programs[i], paths[i], capacity_given)) {
+            perror(paths[i]);
+            return EXIT_FAILURE;
+        }
+
+        struct cpu *cpu = program_acquire(&programs[i]);
+        if (cpu == NULL) {
+            fprintf(stderr, "%s: not a valid program\n", paths[i]);
+            return EXIT_FAILURE;
+        }
+        program_release(&programs[i], cpu);
+    }
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "%s: socket path too long\n", socket_path);
+        return EXIT_FAILURE;
+    }
+    strcpy(address.sun_path, socket_path);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        perror("socket");
+        return EXIT_FAILURE;
+    }
+    unlink(socket_path);
+    if (bind(listener, (struct sockaddr *) &address, sizeof(address)) != 0
+        || listen(listener, SOMAXCONN) != 0) {
+        perror(socket_path);
+        close(listener);
+        return EXIT_FAILURE;
+    }
+
+    fprintf(stderr, "serving %zu program(s) on %s\n", count, socket_path);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    // one thread per connection, the cpus are shared through the pools
+    while (true) {
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            perror("accept");
+            break;
+        }
+
+        struct connection *connection = malloc(sizeof(struct connection));
+        pthread_t thread;
+        if (connection == NULL) {
+            close(fd);
+            continue;
+        }
+        connection->programs = programs;
+        connection->count = count;
+        connection->fd = fd;
+        if (pthread_create(&thread, &attr, serve_connection, connection) != 0) {
+            close(fd);
+            free(connection);
+        }
+    }
+
+    pthread_attr_destroy(&attr);
+    close(listener);
+    return EXIT_FAILURE;
+}
+
+int cpu_serve_call(const char *socket_path, const struct cpu_serve_request *request,
+    const void *input, struct cpu_serve_response *response, FILE *output)
+{
+    // check if the parameters are NULL
+    assert(socket_path != NULL);
+    assert(request != NULL);
+    assert(response != NULL);
+    assert(output != NULL);
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(address.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *) &address, sizeof(address)) != 0
+        || write_all(fd, request, sizeof(*request)) != 0
+        || write_all(fd, input, request->input_size) != 0
+        || read_all(fd, response, sizeof(*response)) != 1) {
+        close(fd);
+        return -1;
+    }
+
+    // copy the guest output through
+    char buffer[4096];
+    size_t left = response->output_size;
+    while (left > 0) {
+        size_t chunk = left < sizeof(buffer) ? left : sizeof(buffer);
+        if (read_all(fd, buffer, chunk) != 1) {
+            close(fd);
+            return -1;
+        }
+        fwrite(buffer, 1, chunk, output);
+        left -= chunk;
+    }
+
+    close(fd);
+    return 0;
+}
+
+static int read_all(int fd, void *buffer, size_t size)
+{
+    // returns 1 when everything was read, 0 on EOF before the first byte, -1 otherwise
+    size_t done = 0;
+    while (done < size) {
+        ssize_t got = read(fd, (char *) buffer + done, size - done);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return (got == 0 && done == 0) ? 0 : -1;
+        }
+        done += got;
+    }
+    return 1;
+}
+
+static int write_all(int fd, const void *buffer, size_t size)
+{
+    size_t done = 0;
+    while (done < size) {
+        ssize_t put = write(fd, (const char *) buffer + done, size - done);
+        if (put < 0 && errno == EINTR) {
+            continue;
+        }
+        if (put <= 0) {
+            return -1;
+        }
+        done += put;
+    }
+    return 0;
+}
+
+static unsigned char *read_image(FILE *fptr, size_t *size)
+{
+    // read the whole file, doubling the buffer as needed
+    size_t capacity = 4096;
+    size_t length = 0;
+    unsigned char *image = malloc(capacity);
+    while (image != NULL) {
+        length += fread(image + length, 1, capacity - length, fptr);
+        if (length < capacity) {
+            break;
+        }
+        unsigned char *new_image = realloc(image, capacity * 2);
+        if (new_image == NULL) {
+            free(image);
+            image = NULL;
+            break;
+        }
+        image = new_image;
+        capacity *= 2;
+    }
+
+    if (image != NULL && ferror(fptr)) {
+        free(image);
+        image = NULL;
+    }
+    *size = length;
+    return image;
+}
+
+// checks an image once and keeps only its program words, the pooled cpus load from them
+static int unpack_image(struct program *program, int fd, bool capacity_given)
+{
+    struct cpu_image image;
+    if (!cpu_image_open(&image, fd)) {
+        return 0;
+    }
+
+    // the image recommends a stack capacity unless one was given
+    if (!capacity_given && image.header.stack_capacity != 0) {
+        program->stack_capacity = image.header.stack_capacity;
+    }
+
+    int32_t *stack_ptr;
+    size_t mapped_size;
+    int32_t *memory = cpu_image_map(&image, program->stack_capacity, &stack_ptr, &mapped_size);
+    if (memory == NULL) {
+        return 0;
+    }
+    if (cpu_image_verify(&image, memory)) {
+        program->image_size = image.program->size;
+        program->image = malloc(program->image_size > 0 ? program->image_size : 1);
+        if (program->image != NULL) {
+            memcpy(program->image, memory, program->image_size);
+        }
+    }
+    munmap(memory, mapped_size);
+    program->entry = image.header.entry;
+    return program->image != NULL;
+}
+
+// a raw program or a program image, recognized by its magic
+static int load_program(struct program *program, const char *path, bool capacity_given)
+{
+    FILE *fptr = fopen(path, "rb");
+    if (fptr == NULL) {
+        return 0;
+    }
+
+    int loaded;
+    char magic[4];
+    if (fread(magic, 1, 4, fptr) == 4 && memcmp(magic, CPU_IMAGE_MAGIC, 4) == 0) {
+        loaded = unpack_image(program, fileno(fptr), capacity_given);
+    } else {
+        rewind(fptr);
+        program->image = read_image(fptr, &program->image_size);
+        program->entry = 0;
+        loaded = program->image != NULL;
+    }
+    fclose(fptr);
+    return loaded;
+}
+
+static struct cpu *program_acquire(struct program *program)
+{
+    // take a warm cpu if there is one
+    pthread_mutex_lock(&program->lock);
+    if (program->pooled > 0) {
+        struct cpu *cpu = program->pool[--program->pooled];
+        pthread_mutex_unlock(&program->lock);
+        return cpu;
+    }
+    pthread_mutex_unlock(&program->lock);
+
+    // otherwise load a new one from the image
+    int32_t *stack_ptr;
+    int32_t *memory = cpu_create_memory_from_buffer(program->image, program->image_size,
+        program->stack_capacity, &stack_ptr);
+    if (memory == NULL) {
+        return NULL;
+    }
+
+    struct cpu *cpu = cpu_create(memory, stack_ptr, program->stack_capacity);
+    if (cpu == NULL) {
+        free(memory);
+        return NULL;
+    }
+    cpu_set_entry(cpu, program->entry);
+    return cpu;
+}
+
+static void program_release(struct program *program, struct cpu *cpu)
+{
+    // the program words are never written, so a reset makes the cpu good as new
+    cpu_reset(cpu);
+    cpu_set_io(cpu, stdin, stdout);
+
+    pthread_mutex_lock(&program->lock);
+    if (program->pooled == program->pool_capacity) {
+        size_t capacity = program->pool_capacity == 0 ? 4 : program->pool_capacity * 2;
+        struct cpu **pool = realloc(program->pool, capacity * sizeof(struct cpu *));
+        if (pool == NULL) {
+            pthread_mutex_unlock(&program->lock);
+            cpu_destroy(cpu);
+            free(cpu);
+            return;
+        }
+        program->pool = pool;
+        program->pool_capacity = capacity;
+    }
+    program->pool[program->pooled++] = cpu;
+    pthread_mutex_unlock(&program->lock);
+}
+
+static void serve_request(struct program *program, const struct cpu_serve_request *request,
+    unsigned char *input, struct cpu_serve_response *response, char **output)
+{
+    size_t output_size = 0;
+    FILE *in = fmemopen(input, request->input_size, "rb");
+    FILE *out = open_memstream(output, &output_size);
+    struct cpu *cpu = program_acquire(program);
+    if (in == NULL || out == NULL || cpu == NULL) {
+        response->error = CPU_SERVE_NO_MEMORY;
+        if (in != NULL) {
+            fclose(in);
+        }
+        if (out != NULL) {
+            fclose(out);
+        }
+        if (cpu != NULL) {
+            program_release(program, cpu);
+        }
+        return;
+    }
+
+    // run the guest against the request buffers
+    cpu_set_io(cpu, in, out);
+    response->result = cpu_run(cpu, request->steps);
+    response->status = cpu_get_status(cpu);
+    for (int reg = REGISTER_A; reg <= REGISTER_D; reg++) {
+        response->registers[reg] = cpu_get_register(cpu, reg);
+    }
+    response->stack_size = cpu_get_stack_size(cpu);
+    program_release(program, cpu);
+
+    fclose(in);
+    if (fclose(out) != 0 || output_size > UINT32_MAX) {
+        response->error = CPU_SERVE_TOO_LARGE;
+        return;
+    }
+    response->output_size = output_size;
+}
+
+static void *serve_connection(void *arg)
+{
+    struct connection *connection = arg;
+    struct cpu_serve_request request;
+    unsigned char *input = malloc(1);
+    size_t input_capacity = 1;
+
+    while (input != NULL && read_all(connection->fd, &request, sizeof(request)) == 1) {
+        struct cpu_serve_response response;
+        char *output = NULL;
+        memset(&response, 0, sizeof(response));
+
+        // the input can't be skipped reliably, so oversized requests end the connection
+        if (request.input_size > CPU_SERVE_MAX_INPUT) {
+            response.error = CPU_SERVE_TOO_LARGE;
+            write_all(connection->fd, &response, sizeof(response));
+            break;
+        }
+
+        // receive the input into the connection buffer
+        if (request.input_size > input_capacity) {
+            unsigned char *new_input = realloc(input, request.input_size);
+            if (new_input == NULL) {
+                response.error = CPU_SERVE_NO_MEMORY;
+                write_all(connection->fd, &response, sizeof(response));
+                break;
+            }
+            input = new_input;
+            input_capacity = request.input_size;
+        }
+        if (read_all(connection->fd, input, request.input_size) != 1 && request.input_size != 0) {
+            break;
+        }
+
+        if (request.program >= connection->count) {
+            response.error = CPU_SERVE_UNKNOWN_PROGRAM;
+        } else {
+            serve_request(&connection->programs[request.program], &request, input, &response, &output);
+        }
+
+        size_t output_size = response.error == CPU_SERVE_OK ? response.output_size : 0;
+        response.output_size = output_size;
+        int written = write_all(connection->fd, &response, sizeof(response)) == 0
+            && write_all(connection->fd, output, output_size) == 0;
+        free(output);
+        if (!written) {
+            break;
+        }
+    }
+
+    free(input);
+    close(connection->fd);
+    free(connection);
+    return NULL;
+}
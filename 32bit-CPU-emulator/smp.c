@@ -0,0 +1,52 @@
+#include "cpu.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+struct core {
+    struct cpu *cpu;
+    size_t steps;
+    long long result;
+};
+
+static void *run_core(void *arg)
+{
+    struct core *core = arg;
+    core->result = cpu_run(core->cpu, core->steps);
+    return NULL;
+}
+
+int cpu_run_smp(struct cpu *const cores[], size_t count, size_t steps, long long results[])
+{
+    // check if the parameters are NULL
+    assert(cores != NULL || count == 0);
+
+    struct core *state = calloc(count, sizeof(struct core));
+    pthread_t *threads = calloc(count, sizeof(pthread_t));
+    if (state == NULL || threads == NULL) {
+        free(state);
+        free(threads);
+        return 0;
+    }
+
+    // every core gets its own host thread
+    size_t started = 0;
+    for (; started < count; started++) {
+        state[started].cpu = cores[started];
+        state[started].steps = steps;
+        if (pthread_create(&threads[started], NULL, run_core, &state[started]) != 0) {
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+        if (results != NULL) {
+            results[i] = state[i].result;
+        }
+    }
+
+    free(state);
+    free(threads);
+    return started == count;
+}
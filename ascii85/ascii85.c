@@ -1,128 +1,214 @@
-#include <ctype.h>
+#define _POSIX_C_SOURCE 200809L
+#include "ascii85.h"
+#include "mapped.h"
+#include "parallel.h"
+#include "pipeline.h"
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <string.h> 
+#include <string.h>
+#include <unistd.h>
 
-void encode_output(long res_bytes);
-void decode_output(long res);
+// size of the read and write blocks
+#define BLOCK_SIZE (1 << 20)
 
-int encode(void)
-{
-    long input;
-    long result_bytes = 0;
-    short int char_counter = 0;
-
-    // read from input
-    while ((input = getchar()) != EOF) {
-
-        // place bytes next to each other
-        input = input << (8 * (3 - char_counter));
-        result_bytes += input;
-        char_counter += 1;
-
-        // encode 4 characters at a time
-        if (char_counter == 4) {
-            encode_output(result_bytes);
-            result_bytes = 0;
-            char_counter = 0;
-        }
-    }
+// upper limit for -j
+#define MAX_THREADS 256
 
-    // encode leftover bytes
-    if (char_counter != 0) {
-        encode_output(result_bytes);
-    }
-    printf("\n");
-    return 0;
-}
+static unsigned char input_buffer[BLOCK_SIZE];
+static unsigned char output_buffer[BLOCK_SIZE / 4 * 5 + 8];
 
-void encode_output(long res_bytes)
+static ssize_t read_block(unsigned char *buffer, size_t size)
 {
-    // output encoded characters
-    int remainder = 0;
-    for (int i = 0; i < 5; i++) {
-        remainder = res_bytes % 85;
-        res_bytes /= 85;
-        printf("%c", remainder + 33);
-    }
+    ssize_t got;
+    do {
+        got = read(STDIN_FILENO, buffer, size);
+    } while (got < 0 && errno == EINTR);
+    return got;
 }
 
-int decode(void)
+static int write_block(const unsigned char *buffer, size_t size)
 {
-    long input;
-    long result = 0;
-    int powers = 1;
-    short int char_counter = 0;
-
-    // read from input
-    while ((input = getchar()) != EOF) {
-
-        // ignore whitespace characters
-        if (isspace(input)) {
+    while (size > 0) {
+        ssize_t written = write(STDOUT_FILENO, buffer, size);
+        if (written < 0 && errno == EINTR) {
             continue;
         }
-
-        // check for invalid characters
-        if (input < 33 || input > 125) {
+        if (written <= 0) {
             return 1;
         }
+        buffer += written;
+        size -= written;
+    }
+    return 0;
+}
 
-        // decode input
-        input -= 33;
-        input *= powers;
-        result += input;
-        powers *= 85;
-        char_counter += 1;
+int encode(int flags)
+{
+    struct ascii85_encoder encoder;
+    ascii85_encoder_init(&encoder, flags);
+    size_t length;
+    ssize_t got;
+
+    // read from input, a partial group waits in the encoder
+    while ((got = read_block(input_buffer, BLOCK_SIZE)) > 0) {
+        if (ascii85_encode_update(&encoder, input_buffer, got, output_buffer, sizeof(output_buffer), &length) != ASCII85_OK
+            || write_block(output_buffer, length) != 0) {
+            return 1;
+        }
+    }
+    if (got < 0) {
+        return 1;
+    }
 
-        // output 5 characters at a time
-        if (char_counter == 5) {
+    // encode leftover bytes
+    if (ascii85_encode_finish(&encoder, output_buffer, sizeof(output_buffer), &length) != ASCII85_OK) {
+        return 1;
+    }
+    output_buffer[length++] = '\n';
+    return write_block(output_buffer, length);
+}
 
-            // check if decoded input is bigger than 4 bytes
-            if (result > 0xFFFFFFFF) {
+int decode(int flags)
+{
+    static struct ascii85_decoder decoder;
+    ascii85_decoder_init(&decoder, flags);
+    size_t length;
+    ssize_t got;
+
+    // read from input, what was decoded before an error is still written
+    while ((got = read_block(input_buffer, BLOCK_SIZE)) > 0) {
+        for (size_t offset = 0; offset < (size_t) got; ) {
+
+            // a 'z' decodes to 4 bytes, so Adobe input may need several pieces
+            size_t piece = ascii85_decode_input_limit(&decoder, sizeof(output_buffer));
+            if (piece > got - offset) {
+                piece = got - offset;
+            }
+            enum ascii85_status status = ascii85_decode_update(&decoder, input_buffer + offset, piece,
+                output_buffer, sizeof(output_buffer), &length);
+            if (write_block(output_buffer, length) != 0 || status != ASCII85_OK) {
                 return 1;
             }
-
-            decode_output(result);
-            result = 0;
-            powers = 1;
-            char_counter = 0;
+            offset += piece;
         }
     }
 
-    // check if input length was not divisible by 5
-    if (char_counter != 0) {
+    // check if reading failed or input length was not divisible by 5
+    if (got < 0 || ascii85_decode_finish(&decoder) != ASCII85_OK) {
         return 1;
     }
     return 0;
 }
 
-void decode_output(long res)
+static void usage(const char *name)
 {
-    // output decoded characters
-    long res_copy;
-    int output;
-    for (int i = 0; i < 4; i++) {
-        res_copy = res;
-        res_copy = res_copy >> (8 * (3 - i));
-        res_copy = res_copy & 255;
-        output = res_copy;
-        printf("%c", output);
-    }
+    fprintf(stderr, "usage: %s [-e|-d] [-a] [-y] [-c] [-b ascii85|z85|rfc1924] [-j N] [-i FILE] [-o FILE]\n", name);
 }
 
+// puts the file in place of stdin or stdout
+static int redirect(const char *path, int flags, int fd)
+{
+    int opened = open(path, flags, 0666);
+    if (opened < 0) {
+        return 1;
+    }
+    if (opened != fd && (dup2(opened, fd) < 0 || close(opened) != 0)) {
+        return 1;
+    }
+    return 0;
+}
 
 int main(int argc, char *argv[])
 {
     int retcode = 1;
+    int decoding = 0;
+    int flags = 0;
+    long threads = 1;
+    const char *input = NULL;
+    const char *output = NULL;
+    int option;
+
+    while ((option = getopt(argc, argv, "edaycb:j:i:o:")) != -1) {
+        char *end;
+        switch (option) {
+            case 'e':
+                decoding = 0;
+                break;
+            case 'd':
+                decoding = 1;
+                break;
+            case 'a':
+                flags |= ASCII85_ADOBE;
+                break;
+            case 'y':
+                flags |= ASCII85_ADOBE | ASCII85_SPACES;
+                break;
+            case 'c':
+                flags |= ASCII85_CHECKSUM;
+                break;
+            case 'b':
+                flags &= ~(ASCII85_Z85 | ASCII85_RFC1924);
+                if (strcmp(optarg, "z85") == 0) {
+                    flags |= ASCII85_Z85;
+                } else if (strcmp(optarg, "rfc1924") == 0) {
+                    flags |= ASCII85_RFC1924;
+                } else if (strcmp(optarg, "ascii85") != 0) {
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'j':
+                threads = strtol(optarg, &end, 10);
+                if (*end != '\0' || threads < 1 || threads > MAX_THREADS) {
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'i':
+                input = optarg;
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    // the Adobe format has its own alphabet
+    if (optind != argc || ((flags & ASCII85_ADOBE) && (flags & (ASCII85_Z85 | ASCII85_RFC1924)))) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
 
-    if (argc == 1 || (argc == 2 && strcmp(argv[1], "-e") == 0)) {
-        retcode = encode();
-    } else if (argc == 2 && strcmp(argv[1], "-d") == 0) {
-        retcode = decode();
-    } else {
-        fprintf(stderr, "usage: %s [-e|-d]\n", argv[0]);
+    // the output is opened for reading too, mapping it needs that
+    if (input != NULL && redirect(input, O_RDONLY, STDIN_FILENO) != 0) {
+        perror(input);
         return EXIT_FAILURE;
     }
+    if (output != NULL && redirect(output, O_RDWR | O_CREAT | O_TRUNC, STDOUT_FILENO) != 0
+        && redirect(output, O_WRONLY | O_CREAT | O_TRUNC, STDOUT_FILENO) != 0) {
+        perror(output);
+        return EXIT_FAILURE;
+    }
+
+    // chunks need regular files on both ends and plain fixed size groups, a
+    // mapping a regular input, anything else is streamed, with -j through
+    // the threaded pipeline
+    if (threads > 1 && flags == 0 && parallel_supported()) {
+        retcode = decoding ? decode_parallel(threads) : encode_parallel(threads);
+    } else if (mapped_supported()) {
+        if (threads > 1) {
+            fprintf(stderr, "-j ignored: chunks need the plain format and regular files on both ends\n");
+        }
+        retcode = decoding ? decode_mapped(flags) : encode_mapped(flags);
+    } else if (threads > 1) {
+        retcode = decoding ? decode_pipeline(threads, flags) : encode_pipeline(threads, flags);
+    } else {
+        retcode = decoding ? decode(flags) : encode(flags);
+    }
 
     if (retcode != 0) {
         fprintf(stderr, "an error occurred\n");
@@ -0,0 +1,96 @@
+#ifndef ASCII85_H
+#define ASCII85_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Incremental ASCII85 codec. The state objects belong to the caller, the
+// functions never allocate and only write into the buffers they are given.
+//
+// Every 4 input bytes become 5 characters, least significant digit first; a
+// short final group is zero padded and still takes 5 characters. The decoder
+// skips whitespace and accepts characters 33 to 125.
+//
+// ASCII85_ADOBE switches to the Adobe format instead: most significant digit
+// first, 'z' for a group of zeros, a final group of n bytes in n + 1
+// characters and the data between "<~" and "~>" (the "<~" is optional when
+// decoding, anything after "~>" is ignored). ASCII85_SPACES adds the btoa 'y'
+// for a group of four spaces to it.
+//
+// ASCII85_CHECKSUM appends the CRC-32C of the decoded bytes (including the
+// zero padding of the default format) as one more group after the end of the
+// data, "~" in the default format and "~>" in the Adobe one, and the decoder
+// checks it. The CRC is computed while the data is encoded or decoded.
+//
+// ASCII85_Z85 and ASCII85_RFC1924 keep the padded groups of the default
+// format but write them most significant digit first in the Z85 and the RFC
+// 1924 alphabet, which is what ZeroMQ and Python's b85encode (with pad=True)
+// produce. RFC 1924 has a '~' digit, its checksum marker is a '.' instead.
+// Neither goes with ASCII85_ADOBE.
+
+// the library is built with hidden symbols, only these functions are exported
+#if defined(__GNUC__)
+#define ASCII85_API __attribute__((visibility("default")))
+#else
+#define ASCII85_API
+#endif
+
+// digits the decoder compacts at once, part of its state
+#define ASCII85_DECODE_CHUNK 8192
+
+// flags for ascii85_encoder_init and ascii85_decoder_init
+#define ASCII85_ADOBE 1
+#define ASCII85_SPACES 2
+#define ASCII85_CHECKSUM 4
+#define ASCII85_Z85 8
+#define ASCII85_RFC1924 16
+
+enum ascii85_status
+{
+    ASCII85_OK,
+    ASCII85_INVALID_CHARACTER,
+    ASCII85_OVERFLOW,
+    ASCII85_TRUNCATED,
+    ASCII85_BUFFER_TOO_SMALL,
+    ASCII85_CHECKSUM_MISMATCH
+};
+
+struct ascii85_encoder {
+    int flags;
+    int started;
+    uint32_t checksum;
+    unsigned char pending[4];
+    size_t pending_size;
+};
+
+struct ascii85_decoder {
+    int flags;
+    int stage;
+    enum ascii85_status status;
+    uint32_t checksum;
+    unsigned char trailer[5];
+    size_t trailer_size;
+    size_t pending_size;
+    unsigned char digits[4 + ASCII85_DECODE_CHUNK + 32];
+};
+
+// function headers
+ASCII85_API size_t ascii85_encoded_size(size_t size, int flags);
+ASCII85_API size_t ascii85_decoded_size_max(size_t size, int flags);
+
+ASCII85_API void ascii85_encoder_init(struct ascii85_encoder *encoder, int flags);
+ASCII85_API size_t ascii85_encode_update_size(const struct ascii85_encoder *encoder, size_t in_len);
+ASCII85_API size_t ascii85_encode_input_limit(const struct ascii85_encoder *encoder, size_t out_cap);
+ASCII85_API size_t ascii85_encode_finish_size(const struct ascii85_encoder *encoder);
+ASCII85_API enum ascii85_status ascii85_encode_update(struct ascii85_encoder *encoder, const void *in, size_t in_len,
+    void *out, size_t out_cap, size_t *out_len);
+ASCII85_API enum ascii85_status ascii85_encode_finish(struct ascii85_encoder *encoder, void *out, size_t out_cap, size_t *out_len);
+
+ASCII85_API void ascii85_decoder_init(struct ascii85_decoder *decoder, int flags);
+ASCII85_API size_t ascii85_decode_update_size(const struct ascii85_decoder *decoder, size_t in_len);
+ASCII85_API size_t ascii85_decode_input_limit(const struct ascii85_decoder *decoder, size_t out_cap);
+ASCII85_API enum ascii85_status ascii85_decode_update(struct ascii85_decoder *decoder, const void *in, size_t in_len,
+    void *out, size_t out_cap, size_t *out_len);
+ASCII85_API enum ascii85_status ascii85_decode_finish(struct ascii85_decoder *decoder);
+
+#endif // ASCII85_H
@@ -0,0 +1,469 @@
+#define _POSIX_C_SOURCE 200809L
+#include "ascii85.h"
+#include "kernels.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+// Measures every kernel on generated inputs and prints one CSV line per
+// measurement. Throughput is counted in raw (unencoded) bytes for both
+// directions, cycles are time stamp counter cycles, and every result comes
+// with a round trip check against the input.
+
+// smallest and default largest input size
+#define MIN_SIZE 1024
+#define DEFAULT_MAX_SIZE (64 << 20)
+
+// input given to the streaming kernels per call
+#define PIECE_SIZE (1 << 20)
+
+// upper limit for -j
+#define MAX_THREADS 256
+
+enum mode
+{
+    MODE_RAW,
+    MODE_STREAM,
+    MODE_THREADED
+};
+
+struct kernel {
+    const char *name;
+    const char *feature;
+    enum mode mode;
+    int flags;
+    encode_kernel encode;
+    compact_kernel compact;
+    decode_kernel decode;
+};
+
+struct job {
+    const struct kernel *kernel;
+    int threads;
+    const unsigned char *data;
+    size_t size;
+    unsigned char *encoded;
+    size_t encoded_size;
+    unsigned char *digits;
+    unsigned char *decoded;
+    size_t decoded_capacity;
+};
+
+// one thread's part of a threaded run, in groups
+struct slice {
+    const struct job *job;
+    size_t first;
+    size_t groups;
+    int decoding;
+    int failed;
+};
+
+static struct kernel kernels[] = {
+    {"scalar", NULL, MODE_RAW, 0, encode_scalar, compact_scalar, decode_scalar},
+    {"sse4.1", "sse4.1", MODE_RAW, 0, encode_sse41, compact_sse41, decode_sse41},
+    {"avx2", "avx2", MODE_RAW, 0, encode_avx2, compact_avx2, decode_avx2},
+    {"buffered", NULL, MODE_STREAM, 0, NULL, NULL, NULL},
+    {"adobe", NULL, MODE_STREAM, ASCII85_ADOBE, NULL, NULL, NULL},
+    {"checksum", NULL, MODE_STREAM, ASCII85_CHECKSUM, NULL, NULL, NULL},
+    {"z85", NULL, MODE_STREAM, ASCII85_Z85, NULL, NULL, NULL},
+    {"rfc1924", NULL, MODE_STREAM, ASCII85_RFC1924, NULL, NULL, NULL},
+    {"kernel-threads", NULL, MODE_THREADED, 0, NULL, NULL, NULL},
+};
+
+static const char *words[] = {
+    "the", "quick", "brown", "fox", "jumps", "over", "lazy", "dog", "encode", "decode",
+    "group", "digit", "stream", "buffer", "kernel", "and", "of", "to", "in", "a",
+};
+
+static int available(const struct kernel *kernel)
+{
+    if (kernel->feature == NULL) {
+        return 1;
+    }
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (strcmp(kernel->feature, "avx2") == 0) {
+        return __builtin_cpu_supports("avx2");
+    }
+    if (strcmp(kernel->feature, "sse4.1") == 0) {
+        return __builtin_cpu_supports("sse4.1");
+    }
+#endif
+    return 0;
+}
+
+static void generate(unsigned char *data, size_t size, const char *input)
+{
+    uint64_t state = 0x9e3779b97f4a7c15u;
+    if (strcmp(input, "zero") == 0) {
+        memset(data, 0, size);
+    } else if (strcmp(input, "random") == 0) {
+        for (size_t i = 0; i < size; i++) {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            data[i] = (unsigned char) (state >> 32);
+        }
+    } else {
+
+        // words separated by spaces with a newline now and then
+        size_t i = 0;
+        while (i < size) {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            const char *word = words[state % (sizeof(words) / sizeof(words[0]))];
+            for (size_t k = 0; word[k] != '\0' && i < size; k++) {
+                data[i++] = word[k];
+            }
+            if (i < size) {
+                data[i++] = (state >> 40) % 12 == 0 ? '\n' : ' ';
+            }
+        }
+    }
+}
+
+static double now(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+static uint64_t cycles(void)
+{
+#ifdef HAVE_X86_KERNELS
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// encodes whole groups with the kernel and the padded last group like the CLI does
+static void encode_raw(const struct job *job, encode_kernel encode, size_t first, size_t groups)
+{
+    size_t whole = job->size / 4;
+    size_t end = first + groups;
+    size_t stop = end < whole ? end : whole;
+    if (stop > first) {
+        encode(job->data + first * 4, stop - first, job->encoded + first * 5);
+    }
+    if (end > whole) {
+        unsigned char group[4] = {0};
+        memcpy(group, job->data + whole * 4, job->size - whole * 4);
+        encode_scalar(group, 1, job->encoded + whole * 5);
+    }
+}
+
+static int decode_raw(const struct job *job, compact_kernel compact, decode_kernel decode, size_t first, size_t groups)
+{
+    size_t consumed;
+    size_t count = compact(job->encoded + first * 5, groups * 5, job->digits + first * 5, &consumed);
+    return count != groups * 5 || decode(job->digits + first * 5, groups, job->decoded + first * 4) != groups;
+}
+
+static void *run_slice(void *arg)
+{
+    struct slice *slice = arg;
+    const struct kernel *best = slice->job->kernel;
+    if (slice->decoding) {
+        slice->failed = decode_raw(slice->job, best->compact, best->decode, slice->first, slice->groups);
+    } else {
+        encode_raw(slice->job, best->encode, slice->first, slice->groups);
+    }
+    return NULL;
+}
+
+// splits the groups between the threads, the calling thread takes the first part
+static int run_threaded(const struct job *job, size_t groups, int decoding)
+{
+    struct slice slices[MAX_THREADS];
+    pthread_t threads[MAX_THREADS];
+    size_t share = (groups + job->threads - 1) / job->threads;
+    int started = 0;
+    int failed = 0;
+
+    for (int i = 0; i < job->threads; i++) {
+        size_t first = i * share < groups ? i * share : groups;
+        slices[i].job = job;
+        slices[i].first = first;
+        slices[i].groups = groups - first < share ? groups - first : share;
+        slices[i].decoding = decoding;
+        slices[i].failed = 0;
+    }
+    while (started < job->threads - 1 && pthread_create(&threads[started], NULL, run_slice, &slices[started + 1]) == 0) {
+        started++;
+    }
+    run_slice(&slices[0]);
+
+    // slices whose thread didn't start run here
+    for (int i = started + 1; i < job->threads; i++) {
+        run_slice(&slices[i]);
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    for (int i = 0; i < job->threads; i++) {
+        failed |= slices[i].failed;
+    }
+    return failed;
+}
+
+// returns the length of the encoded text
+static size_t encode_job(struct job *job)
+{
+    const struct kernel *kernel = job->kernel;
+    size_t groups = (job->size + 3) / 4;
+
+    if (kernel->mode == MODE_RAW) {
+        encode_raw(job, kernel->encode, 0, groups);
+        return groups * 5;
+    }
+    if (kernel->mode == MODE_THREADED) {
+        run_threaded(job, groups, 0);
+        return groups * 5;
+    }
+
+    struct ascii85_encoder encoder;
+    size_t capacity = ascii85_encoded_size(job->size, kernel->flags);
+    size_t length = 0;
+    size_t written;
+    ascii85_encoder_init(&encoder, kernel->flags);
+    for (size_t offset = 0; offset < job->size; offset += PIECE_SIZE) {
+        size_t piece = job->size - offset < PIECE_SIZE ? job->size - offset : PIECE_SIZE;
+        ascii85_encode_update(&encoder, job->data + offset, piece, job->encoded + length, capacity - length, &written);
+        length += written;
+    }
+    ascii85_encode_finish(&encoder, job->encoded + length, capacity - length, &written);
+    return length + written;
+}
+
+// returns the length of the decoded data, or SIZE_MAX on an error
+static size_t decode_job(struct job *job)
+{
+    const struct kernel *kernel = job->kernel;
+    size_t groups = job->encoded_size / 5;
+
+    if (kernel->mode == MODE_RAW) {
+        return decode_raw(job, kernel->compact, kernel->decode, 0, groups) != 0 ? SIZE_MAX : groups * 4;
+    }
+    if (kernel->mode == MODE_THREADED) {
+        return run_threaded(job, groups, 1) != 0 ? SIZE_MAX : groups * 4;
+    }
+
+    static struct ascii85_decoder decoder;
+    size_t length = 0;
+    size_t written;
+    ascii85_decoder_init(&decoder, kernel->flags);
+    for (size_t offset = 0; offset < job->encoded_size; ) {
+        size_t piece = ascii85_decode_input_limit(&decoder, job->decoded_capacity - length);
+        if (piece > PIECE_SIZE) {
+            piece = PIECE_SIZE;
+        }
+        if (piece > job->encoded_size - offset) {
+            piece = job->encoded_size - offset;
+        }
+        if (ascii85_decode_update(&decoder, job->encoded + offset, piece, job->decoded + length,
+                job->decoded_capacity - length, &written) != ASCII85_OK) {
+            return SIZE_MAX;
+        }
+        length += written;
+        offset += piece;
+    }
+    return ascii85_decode_finish(&decoder) == ASCII85_OK ? length : SIZE_MAX;
+}
+
+// best time and cycles of repeated runs taking at least `minimum` seconds together
+static void measure(struct job *job, int decoding, double minimum, double *best_time, uint64_t *best_cycles)
+{
+    double total = 0;
+    *best_time = 0;
+    *best_cycles = 0;
+    do {
+        double start = now();
+        uint64_t start_cycles = cycles();
+        if (decoding) {
+            decode_job(job);
+        } else {
+            encode_job(job);
+        }
+        uint64_t used_cycles = cycles() - start_cycles;
+        double used = now() - start;
+        if (*best_time == 0 || used < *best_time) {
+            *best_time = used;
+            *best_cycles = used_cycles;
+        }
+        total += used;
+    } while (total < minimum);
+}
+
+static void report(const char *operation, const struct kernel *kernel, const char *input, size_t size,
+    double time, uint64_t used_cycles, int ok)
+{
+    printf("%s,%s,%s,%zu,%.1f,", operation, kernel->name, input, size, time > 0 ? size / time / 1e6 : 0);
+#ifdef HAVE_X86_KERNELS
+    printf("%.3f", (double) used_cycles / size);
+#endif
+    printf(",%s\n", ok ? "ok" : "FAILED");
+    fflush(stdout);
+}
+
+static int bench_size(size_t size, const char *input, int threads, double minimum)
+{
+    size_t groups = (size + 3) / 4;
+    unsigned char *data = malloc(size);
+    unsigned char *reference = malloc(groups * 5);
+    struct job job;
+    job.threads = threads;
+    job.data = data;
+    job.size = size;
+    job.encoded = malloc(ascii85_encoded_size(size, ASCII85_ADOBE | ASCII85_CHECKSUM));
+    job.digits = malloc(groups * 5 + COMPACT_SLACK);
+
+    // room for the padded last group, and for the decoder's bound on the last pieces
+    job.decoded_capacity = groups * 4 + 4 * PIECE_SIZE;
+    job.decoded = malloc(job.decoded_capacity);
+    int failed = 0;
+    if (data == NULL || reference == NULL || job.encoded == NULL || job.digits == NULL || job.decoded == NULL) {
+        fprintf(stderr, "not enough memory for %zu bytes\n", size);
+        failed = 1;
+        goto cleanup;
+    }
+    generate(data, size, input);
+
+    // every default mode kernel has to produce what the scalar one does
+    job.kernel = &kernels[0];
+    encode_job(&job);
+    memcpy(reference, job.encoded, groups * 5);
+
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+        struct kernel *kernel = &kernels[i];
+        double time;
+        uint64_t used_cycles;
+        if (!available(kernel)) {
+            continue;
+        }
+        job.kernel = kernel;
+        job.encoded_size = encode_job(&job);
+        int ok = kernel->flags != 0 || (job.encoded_size == groups * 5 && memcmp(job.encoded, reference, groups * 5) == 0);
+        measure(&job, 0, minimum, &time, &used_cycles);
+        report("encode", kernel, input, size, time, used_cycles, ok);
+        failed |= !ok;
+
+        size_t length = decode_job(&job);
+        ok = length != SIZE_MAX && length >= size && memcmp(job.decoded, data, size) == 0;
+        measure(&job, 1, minimum, &time, &used_cycles);
+        report("decode", kernel, input, size, time, used_cycles, ok);
+        failed |= !ok;
+    }
+
+cleanup:
+    free(data);
+    free(reference);
+    free(job.encoded);
+    free(job.digits);
+    free(job.decoded);
+    return failed;
+}
+
+static int parse_size(const char *text, size_t *size)
+{
+    char *end;
+    unsigned long long value = strtoull(text, &end, 10);
+    switch (*end) {
+        case 'G':
+            value <<= 10;
+            // fall through
+        case 'M':
+            value <<= 10;
+            // fall through
+        case 'K':
+            value <<= 10;
+            end++;
+            break;
+        default:
+            break;
+    }
+    *size = value;
+    return *end != '\0' || value < MIN_SIZE;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-m MAX_SIZE[K|M|G]] [-j N] [-t SECONDS]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    static const char *inputs[] = {"random", "zero", "text"};
+    size_t max_size = DEFAULT_MAX_SIZE;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    double minimum = 0.2;
+    int option;
+    char *end;
+
+    while ((option = getopt(argc, argv, "m:j:t:")) != -1) {
+        switch (option) {
+            case 'm':
+                if (parse_size(optarg, &max_size) != 0) {
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'j':
+                threads = strtol(optarg, &end, 10);
+                if (*end != '\0' || threads < 1 || threads > MAX_THREADS) {
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 't':
+                minimum = strtod(optarg, &end);
+                if (*end != '\0' || minimum < 0) {
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (threads < 1 || threads > MAX_THREADS) {
+        threads = threads < 1 ? 1 : MAX_THREADS;
+    }
+
+    // kernel-threads splits the work between the fastest single thread kernels, with
+    // no I/O in between it shows how the kernels alone scale, not the CLI's -j
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+        if (kernels[i].mode == MODE_THREADED) {
+            kernels[i].encode = encode_select();
+            decode_select(&kernels[i].compact, &kernels[i].decode);
+        }
+    }
+
+    // sizes grow 16 times at a step, 4 GiB is the last
+    int failed = 0;
+    printf("operation,kernel,input,bytes,mb_per_s,cycles_per_byte,roundtrip\n");
+    for (size_t size = MIN_SIZE; size <= max_size; size = size < ((size_t) 1 << 30) ? size * 16 : size * 4) {
+        for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+            failed |= bench_size(size, inputs[i], (int) threads, minimum);
+        }
+        if (size >= ((size_t) 4 << 30)) {
+            break;
+        }
+    }
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
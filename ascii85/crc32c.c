@@ -0,0 +1,182 @@
+#include "kernels.h"
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+// CRC-32C (Castagnoli), reflected polynomial
+#define POLY 0x82f63b78u
+
+// The SSE4.2 kernel runs three independent crc32 chains over adjacent blocks
+// to hide the latency of the instruction, then shifts the first CRCs over the
+// blocks after them with the zeros tables and adds them up.
+#define LONG_BLOCK 8192
+#define SHORT_BLOCK 256
+
+static uint32_t byte_table[256];
+static uint32_t long_zeros[4][256];
+static uint32_t short_zeros[4][256];
+
+uint32_t crc32c_scalar(uint32_t crc, const unsigned char *data, size_t length)
+{
+    for (size_t i = 0; i < length; i++) {
+        crc = byte_table[(crc ^ data[i]) & 0xff] ^ crc >> 8;
+    }
+    return crc;
+}
+
+static void build_byte_table(void)
+{
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t crc = n;
+        for (int k = 0; k < 8; k++) {
+            crc = crc & 1 ? crc >> 1 ^ POLY : crc >> 1;
+        }
+        byte_table[n] = crc;
+    }
+}
+
+#ifdef HAVE_X86_KERNELS
+
+static uint32_t matrix_times(const uint32_t *matrix, uint32_t vector)
+{
+    uint32_t sum = 0;
+    for (; vector != 0; vector >>= 1, matrix++) {
+        if (vector & 1) {
+            sum ^= *matrix;
+        }
+    }
+    return sum;
+}
+
+static void matrix_square(uint32_t *square, const uint32_t *matrix)
+{
+    for (int n = 0; n < 32; n++) {
+        square[n] = matrix_times(matrix, matrix[n]);
+    }
+}
+
+// tables that run a CRC over `length` zero bytes, one per byte of the CRC
+static void build_zeros(uint32_t zeros[4][256], size_t length)
+{
+    uint32_t even[32];
+    uint32_t odd[32];
+
+    // the operator for one zero bit, squared up to one zero byte
+    odd[0] = POLY;
+    for (int n = 1; n < 32; n++) {
+        odd[n] = 1u << (n - 1);
+    }
+    matrix_square(even, odd);
+    matrix_square(odd, even);
+    matrix_square(even, odd);
+
+    // then squared along the bits of the length
+    uint32_t *result = NULL;
+    uint32_t *power = even;
+    uint32_t *spare = odd;
+    uint32_t product[32];
+    for (; length != 0; length >>= 1) {
+        if (length & 1) {
+            if (result == NULL) {
+                memcpy(product, power, sizeof(product));
+                result = product;
+            } else {
+                uint32_t next[32];
+                for (int n = 0; n < 32; n++) {
+                    next[n] = matrix_times(power, result[n]);
+                }
+                memcpy(product, next, sizeof(product));
+            }
+        }
+        matrix_square(spare, power);
+        uint32_t *swap = power;
+        power = spare;
+        spare = swap;
+    }
+
+    for (uint32_t n = 0; n < 256; n++) {
+        zeros[0][n] = matrix_times(result, n);
+        zeros[1][n] = matrix_times(result, n << 8);
+        zeros[2][n] = matrix_times(result, n << 16);
+        zeros[3][n] = matrix_times(result, n << 24);
+    }
+}
+
+static uint32_t shift(uint32_t zeros[4][256], uint32_t crc)
+{
+    return zeros[0][crc & 0xff] ^ zeros[1][crc >> 8 & 0xff] ^ zeros[2][crc >> 16 & 0xff] ^ zeros[3][crc >> 24];
+}
+
+__attribute__((target("sse4.2")))
+static const unsigned char *crc_blocks(uint32_t *crc, const unsigned char *data, size_t *length, size_t block,
+    uint32_t zeros[4][256])
+{
+    uint64_t crc0 = *crc;
+    while (*length >= 3 * block) {
+        uint64_t crc1 = 0;
+        uint64_t crc2 = 0;
+        const unsigned char *end = data + block;
+        for (; data < end; data += 8) {
+            uint64_t word0;
+            uint64_t word1;
+            uint64_t word2;
+            memcpy(&word0, data, 8);
+            memcpy(&word1, data + block, 8);
+            memcpy(&word2, data + 2 * block, 8);
+            crc0 = _mm_crc32_u64(crc0, word0);
+            crc1 = _mm_crc32_u64(crc1, word1);
+            crc2 = _mm_crc32_u64(crc2, word2);
+        }
+        crc0 = shift(zeros, (uint32_t) crc0) ^ crc1;
+        crc0 = shift(zeros, (uint32_t) crc0) ^ crc2;
+        data += 2 * block;
+        *length -= 3 * block;
+    }
+    *crc = (uint32_t) crc0;
+    return data;
+}
+
+__attribute__((target("sse4.2")))
+uint32_t crc32c_sse42(uint32_t crc, const unsigned char *data, size_t length)
+{
+    data = crc_blocks(&crc, data, &length, LONG_BLOCK, long_zeros);
+    data = crc_blocks(&crc, data, &length, SHORT_BLOCK, short_zeros);
+
+    uint64_t crc0 = crc;
+    for (; length >= 8; length -= 8, data += 8) {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        crc0 = _mm_crc32_u64(crc0, word);
+    }
+    crc = (uint32_t) crc0;
+    for (; length > 0; length--, data++) {
+        crc = _mm_crc32_u8(crc, *data);
+    }
+    return crc;
+}
+
+#else
+
+uint32_t crc32c_sse42(uint32_t crc, const unsigned char *data, size_t length)
+{
+    return crc32c_scalar(crc, data, length);
+}
+
+#endif
+
+crc_kernel crc32c_select(void)
+{
+    build_byte_table();
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        build_zeros(long_zeros, LONG_BLOCK);
+        build_zeros(short_zeros, SHORT_BLOCK);
+        return crc32c_sse42;
+    }
+#endif
+    return crc32c_scalar;
+}
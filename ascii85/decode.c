@@ -0,0 +1,564 @@
+#include "kernels.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+// 85^4, the weight of the last digit of a group
+#define POWER_4 52200625
+
+// a group overflows when its last digit is above 82, or 82 with the rest above this
+#define LAST_DIGIT_LIMIT 82
+#define LOW_LIMIT 14516045
+
+// the digit plus one of every character of the other alphabets, zero for the rest
+static unsigned char z85_values[256];
+static unsigned char rfc1924_values[256];
+
+static void build_values(unsigned char *values, const char *characters)
+{
+    for (int digit = 0; digit < 85; digit++) {
+        values[(unsigned char) characters[digit]] = digit + 1;
+    }
+}
+
+void decode_output(uint32_t group, unsigned char *out)
+{
+    // output decoded characters
+    out[0] = group >> 24;
+    out[1] = group >> 16;
+    out[2] = group >> 8;
+    out[3] = group;
+}
+
+size_t compact_scalar(const unsigned char *in, size_t length, unsigned char *digits, size_t *consumed)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = in[i];
+
+        // characters 33 to 125 are digits, whitespace is skipped and anything else stops
+        if (c - 33u <= 92u) {
+            digits[count++] = c - 33;
+        } else if (c != ' ' && c - 9u > 4u) {
+            *consumed = i;
+            return count;
+        }
+    }
+    *consumed = length;
+    return count;
+}
+
+__attribute__((always_inline))
+static inline size_t compact_alphabet_scalar(const unsigned char *in, size_t length, unsigned char *digits,
+    size_t *consumed, int alphabet)
+{
+    const unsigned char *values = alphabet == ALPHABET_Z85 ? z85_values : rfc1924_values;
+    size_t count = 0;
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = in[i];
+
+        // characters of the alphabet are digits, whitespace is skipped and anything else stops
+        if (values[c] != 0) {
+            digits[count++] = values[c] - 1;
+        } else if (c != ' ' && c - 9u > 4u) {
+            *consumed = i;
+            return count;
+        }
+    }
+    *consumed = length;
+    return count;
+}
+
+size_t decode_scalar(const unsigned char *digits, size_t groups, unsigned char *out)
+{
+    for (size_t i = 0; i < groups; i++, digits += 5, out += 4) {
+        uint64_t result = digits[0] + 85 * (digits[1] + 85 * (digits[2] + 85 * (digits[3] + 85 * (uint64_t) digits[4])));
+
+        // check if decoded input is bigger than 4 bytes
+        if (result > 0xFFFFFFFF) {
+            return i;
+        }
+        decode_output((uint32_t) result, out);
+    }
+    return groups;
+}
+
+size_t decode_msb_scalar(const unsigned char *digits, size_t groups, unsigned char *out)
+{
+    for (size_t i = 0; i < groups; i++, digits += 5, out += 4) {
+        uint64_t result = digits[4] + 85 * (digits[3] + 85 * (digits[2] + 85 * (digits[1] + 85 * (uint64_t) digits[0])));
+
+        // check if decoded input is bigger than 4 bytes
+        if (result > 0xFFFFFFFF) {
+            return i;
+        }
+        decode_output((uint32_t) result, out);
+    }
+    return groups;
+}
+
+size_t find_special_scalar(const unsigned char *digits, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        if (digits[i] > MAX_DIGIT) {
+            return i;
+        }
+    }
+    return count;
+}
+
+#ifdef HAVE_X86_KERNELS
+
+// Compaction: a vector of characters is checked for whitespace and for
+// characters outside 33..125 at once. Without whitespace the digits are
+// stored as they are, otherwise every 8 bytes are packed by a shuffle picked
+// by their whitespace bits. Anything invalid leaves the rest to the scalar code.
+// Other alphabets look the characters from 32 to 127 up in their values 16
+// at a time instead, a zero is not a digit.
+//
+// Groups: four groups take 20 digits. The first four digits of every group
+// are gathered into a 32-bit lane and combined with two multiply-adds, the
+// last digit is checked against the overflow limits and added on top. Most
+// significant digit first only gathers the digits the other way round.
+
+static unsigned char compact_table[256][8];
+static unsigned char compact_count[256];
+
+static void build_compact_table(void)
+{
+    for (int mask = 0; mask < 256; mask++) {
+        int count = 0;
+        for (int i = 0; i < 8; i++) {
+            if (!(mask & (1 << i))) {
+                compact_table[mask][count++] = i;
+            }
+        }
+        compact_count[mask] = count;
+        while (count < 8) {
+            compact_table[mask][count++] = 0x80;
+        }
+    }
+}
+
+#define SWAP_MASK 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12
+#define FIRST_LOW_MASK 0, 1, 2, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+#define FIRST_HIGH_MASK -1, -1, -1, -1, 1, 2, 3, 4, 6, 7, 8, 9, 11, 12, 13, 14
+#define LAST_LOW_MASK 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+#define LAST_HIGH_MASK -1, -1, -1, -1, 5, -1, -1, -1, 10, -1, -1, -1, 15, -1, -1, -1
+#define FIRST_LOW_MSB_MASK 4, 3, 2, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+#define FIRST_HIGH_MSB_MASK -1, -1, -1, -1, 5, 4, 3, 2, 10, 9, 8, 7, 15, 14, 13, 12
+#define LAST_LOW_MSB_MASK 0, -1, -1, -1, 5, -1, -1, -1, 10, -1, -1, -1, 15, -1, -1, -1
+#define LAST_HIGH_MSB_MASK -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+
+// _mm_set_epi8 takes the last byte first, the masks above are in memory order
+#define REVERSED(m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12, m13, m14, m15) \
+    m15, m14, m13, m12, m11, m10, m9, m8, m7, m6, m5, m4, m3, m2, m1, m0
+#define MASK(m) REVERSED(m)
+
+__attribute__((target("sse4.1")))
+static size_t compact_chunks(const unsigned char *in, int offset, unsigned mask, size_t chunks, unsigned char *digits)
+{
+    // pack 8 characters at a time by their whitespace bits
+    size_t count = 0;
+    for (size_t k = 0; k < chunks; k++, in += 8, mask >>= 8) {
+        __m128i chunk = _mm_sub_epi8(_mm_loadl_epi64((const __m128i *) in), _mm_set1_epi8(offset));
+        __m128i shuffle = _mm_loadl_epi64((const __m128i *) compact_table[mask & 0xff]);
+        _mm_storel_epi64((__m128i *) (digits + count), _mm_shuffle_epi8(chunk, shuffle));
+        count += compact_count[mask & 0xff];
+    }
+    return count;
+}
+
+// a value minus 16 k saturates past 127 (which shuffles to zero) unless it is in the k-th 16
+__attribute__((target("sse4.1"), always_inline))
+static inline __m128i lookup_sse41(__m128i c, const unsigned char *values)
+{
+    __m128i index = _mm_sub_epi8(c, _mm_set1_epi8(32));
+    __m128i result = _mm_setzero_si128();
+    for (int k = 0; k < 6; k++) {
+        __m128i chunk = _mm_adds_epu8(_mm_sub_epi8(index, _mm_set1_epi8(16 * k)), _mm_set1_epi8(0x70));
+        result = _mm_or_si128(result,
+            _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (values + 32 + 16 * k)), chunk));
+    }
+    return result;
+}
+
+__attribute__((target("avx2"), always_inline))
+static inline __m256i lookup_avx2(__m256i c, const unsigned char *values)
+{
+    __m256i index = _mm256_sub_epi8(c, _mm256_set1_epi8(32));
+    __m256i result = _mm256_setzero_si256();
+    for (int k = 0; k < 6; k++) {
+        __m256i chunk = _mm256_adds_epu8(_mm256_sub_epi8(index, _mm256_set1_epi8(16 * k)), _mm256_set1_epi8(0x70));
+        __m256i table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) (values + 32 + 16 * k)));
+        result = _mm256_or_si256(result, _mm256_shuffle_epi8(table, chunk));
+    }
+    return result;
+}
+
+__attribute__((target("sse4.1"), always_inline))
+static inline size_t compact_groups_sse41(const unsigned char *in, size_t length, unsigned char *digits,
+    size_t *consumed, int alphabet)
+{
+    const unsigned char *values = alphabet == ALPHABET_Z85 ? z85_values : rfc1924_values;
+    const __m128i offset = _mm_set1_epi8(33);
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i c = _mm_loadu_si128((const __m128i *) (in + i));
+
+        // bytes above 127 are negative and fail both checks
+        __m128i space = _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8(' ')),
+            _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8(8)), _mm_cmpgt_epi8(_mm_set1_epi8(14), c)));
+        __m128i digit;
+        if (alphabet == ALPHABET_ASCII85) {
+            digit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8(32)), _mm_cmpgt_epi8(_mm_set1_epi8(126), c));
+        } else {
+            c = lookup_sse41(c, values);
+            digit = _mm_xor_si128(_mm_cmpeq_epi8(c, _mm_setzero_si128()), _mm_set1_epi8(-1));
+        }
+        if (_mm_movemask_epi8(_mm_or_si128(space, digit)) != 0xffff) {
+            break;
+        }
+
+        unsigned mask = _mm_movemask_epi8(space);
+        if (alphabet != ALPHABET_ASCII85) {
+            __m128i value = _mm_sub_epi8(c, _mm_set1_epi8(1));
+            if (mask == 0) {
+                _mm_storeu_si128((__m128i *) (digits + count), value);
+                count += 16;
+            } else {
+                unsigned char found[16];
+                _mm_storeu_si128((__m128i *) found, value);
+                count += compact_chunks(found, 0, mask, 2, digits + count);
+            }
+        } else if (mask == 0) {
+            _mm_storeu_si128((__m128i *) (digits + count), _mm_sub_epi8(c, offset));
+            count += 16;
+        } else {
+            count += compact_chunks(in + i, 33, mask, 2, digits + count);
+        }
+    }
+
+    size_t tail;
+    count += alphabet == ALPHABET_ASCII85 ? compact_scalar(in + i, length - i, digits + count, &tail)
+        : compact_alphabet_scalar(in + i, length - i, digits + count, &tail, alphabet);
+    *consumed = i + tail;
+    return count;
+}
+
+__attribute__((target("sse4.1")))
+size_t compact_sse41(const unsigned char *in, size_t length, unsigned char *digits, size_t *consumed)
+{
+    return compact_groups_sse41(in, length, digits, consumed, ALPHABET_ASCII85);
+}
+
+__attribute__((target("avx2"), always_inline))
+static inline size_t compact_groups_avx2(const unsigned char *in, size_t length, unsigned char *digits,
+    size_t *consumed, int alphabet)
+{
+    const unsigned char *values = alphabet == ALPHABET_Z85 ? z85_values : rfc1924_values;
+    const __m256i offset = _mm256_set1_epi8(33);
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i c = _mm256_loadu_si256((const __m256i *) (in + i));
+        __m256i space = _mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8(' ')),
+            _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8(8)), _mm256_cmpgt_epi8(_mm256_set1_epi8(14), c)));
+        __m256i digit;
+        if (alphabet == ALPHABET_ASCII85) {
+            digit = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8(32)),
+                _mm256_cmpgt_epi8(_mm256_set1_epi8(126), c));
+        } else {
+            c = lookup_avx2(c, values);
+            digit = _mm256_xor_si256(_mm256_cmpeq_epi8(c, _mm256_setzero_si256()), _mm256_set1_epi8(-1));
+        }
+        if ((unsigned) _mm256_movemask_epi8(_mm256_or_si256(space, digit)) != 0xffffffffu) {
+            break;
+        }
+
+        unsigned mask = _mm256_movemask_epi8(space);
+        if (alphabet != ALPHABET_ASCII85) {
+            __m256i value = _mm256_sub_epi8(c, _mm256_set1_epi8(1));
+            if (mask == 0) {
+                _mm256_storeu_si256((__m256i *) (digits + count), value);
+                count += 32;
+            } else {
+                unsigned char found[32];
+                _mm256_storeu_si256((__m256i *) found, value);
+                count += compact_chunks(found, 0, mask, 4, digits + count);
+            }
+        } else if (mask == 0) {
+            _mm256_storeu_si256((__m256i *) (digits + count), _mm256_sub_epi8(c, offset));
+            count += 32;
+        } else {
+            count += compact_chunks(in + i, 33, mask, 4, digits + count);
+        }
+    }
+
+    size_t tail;
+    count += compact_groups_sse41(in + i, length - i, digits + count, &tail, alphabet);
+    *consumed = i + tail;
+    return count;
+}
+
+__attribute__((target("avx2")))
+size_t compact_avx2(const unsigned char *in, size_t length, unsigned char *digits, size_t *consumed)
+{
+    return compact_groups_avx2(in, length, digits, consumed, ALPHABET_ASCII85);
+}
+
+__attribute__((target("sse4.1"), always_inline))
+static inline size_t decode_groups_sse41(const unsigned char *digits, size_t groups, unsigned char *out, int msb)
+{
+    const __m128i weights = _mm_set1_epi16(85 << 8 | 1);
+    const __m128i pair_weights = _mm_set1_epi32(85 * 85 << 16 | 1);
+    const __m128i first_low = msb ? _mm_set_epi8(MASK(FIRST_LOW_MSB_MASK)) : _mm_set_epi8(MASK(FIRST_LOW_MASK));
+    const __m128i first_high = msb ? _mm_set_epi8(MASK(FIRST_HIGH_MSB_MASK)) : _mm_set_epi8(MASK(FIRST_HIGH_MASK));
+    const __m128i last_low = msb ? _mm_set_epi8(MASK(LAST_LOW_MSB_MASK)) : _mm_set_epi8(MASK(LAST_LOW_MASK));
+    const __m128i last_high = msb ? _mm_set_epi8(MASK(LAST_HIGH_MSB_MASK)) : _mm_set_epi8(MASK(LAST_HIGH_MASK));
+    size_t done = 0;
+    for (; done + 4 <= groups; done += 4, digits += 20, out += 16) {
+        __m128i low_digits = _mm_loadu_si128((const __m128i *) digits);
+        __m128i high_digits = _mm_loadu_si128((const __m128i *) (digits + 4));
+        __m128i first = _mm_or_si128(_mm_shuffle_epi8(low_digits, first_low), _mm_shuffle_epi8(high_digits, first_high));
+        __m128i last = _mm_or_si128(_mm_shuffle_epi8(low_digits, last_low), _mm_shuffle_epi8(high_digits, last_high));
+
+        // d0 + 85 d1 and d2 + 85 d3, then both halves together
+        __m128i low = _mm_madd_epi16(_mm_maddubs_epi16(first, weights), pair_weights);
+
+        __m128i overflow = _mm_or_si128(_mm_cmpgt_epi32(last, _mm_set1_epi32(LAST_DIGIT_LIMIT)),
+            _mm_and_si128(_mm_cmpeq_epi32(last, _mm_set1_epi32(LAST_DIGIT_LIMIT)),
+                _mm_cmpgt_epi32(low, _mm_set1_epi32(LOW_LIMIT))));
+        if (!_mm_testz_si128(overflow, overflow)) {
+            break;
+        }
+
+        __m128i value = _mm_add_epi32(low, _mm_mullo_epi32(last, _mm_set1_epi32(POWER_4)));
+        _mm_storeu_si128((__m128i *) out, _mm_shuffle_epi8(value, _mm_set_epi8(MASK(SWAP_MASK))));
+    }
+    return done + (msb ? decode_msb_scalar(digits, groups - done, out) : decode_scalar(digits, groups - done, out));
+}
+
+__attribute__((target("sse4.1")))
+size_t decode_sse41(const unsigned char *digits, size_t groups, unsigned char *out)
+{
+    return decode_groups_sse41(digits, groups, out, 0);
+}
+
+__attribute__((target("sse4.1")))
+size_t decode_msb_sse41(const unsigned char *digits, size_t groups, unsigned char *out)
+{
+    return decode_groups_sse41(digits, groups, out, 1);
+}
+
+__attribute__((target("avx2"), always_inline))
+static inline size_t decode_groups_avx2(const unsigned char *digits, size_t groups, unsigned char *out, int msb)
+{
+    const __m256i weights = _mm256_set1_epi16(85 << 8 | 1);
+    const __m256i pair_weights = _mm256_set1_epi32(85 * 85 << 16 | 1);
+    const __m256i first_low = msb ? _mm256_set_epi8(MASK(FIRST_LOW_MSB_MASK), MASK(FIRST_LOW_MSB_MASK))
+        : _mm256_set_epi8(MASK(FIRST_LOW_MASK), MASK(FIRST_LOW_MASK));
+    const __m256i first_high = msb ? _mm256_set_epi8(MASK(FIRST_HIGH_MSB_MASK), MASK(FIRST_HIGH_MSB_MASK))
+        : _mm256_set_epi8(MASK(FIRST_HIGH_MASK), MASK(FIRST_HIGH_MASK));
+    const __m256i last_low = msb ? _mm256_set_epi8(MASK(LAST_LOW_MSB_MASK), MASK(LAST_LOW_MSB_MASK))
+        : _mm256_set_epi8(MASK(LAST_LOW_MASK), MASK(LAST_LOW_MASK));
+    const __m256i last_high = msb ? _mm256_set_epi8(MASK(LAST_HIGH_MSB_MASK), MASK(LAST_HIGH_MSB_MASK))
+        : _mm256_set_epi8(MASK(LAST_HIGH_MASK), MASK(LAST_HIGH_MASK));
+    const __m256i swap = _mm256_set_epi8(MASK(SWAP_MASK), MASK(SWAP_MASK));
+    size_t done = 0;
+    for (; done + 8 <= groups; done += 8, digits += 40, out += 32) {
+
+        // every 128-bit lane gets the 20 digits of four groups
+        __m256i low_digits = _mm256_loadu2_m128i((const __m128i *) (digits + 20), (const __m128i *) digits);
+        __m256i high_digits = _mm256_loadu2_m128i((const __m128i *) (digits + 24), (const __m128i *) (digits + 4));
+        __m256i first = _mm256_or_si256(_mm256_shuffle_epi8(low_digits, first_low),
+            _mm256_shuffle_epi8(high_digits, first_high));
+        __m256i last = _mm256_or_si256(_mm256_shuffle_epi8(low_digits, last_low),
+            _mm256_shuffle_epi8(high_digits, last_high));
+        __m256i low = _mm256_madd_epi16(_mm256_maddubs_epi16(first, weights), pair_weights);
+
+        __m256i overflow = _mm256_or_si256(_mm256_cmpgt_epi32(last, _mm256_set1_epi32(LAST_DIGIT_LIMIT)),
+            _mm256_and_si256(_mm256_cmpeq_epi32(last, _mm256_set1_epi32(LAST_DIGIT_LIMIT)),
+                _mm256_cmpgt_epi32(low, _mm256_set1_epi32(LOW_LIMIT))));
+        if (!_mm256_testz_si256(overflow, overflow)) {
+            break;
+        }
+
+        __m256i value = _mm256_add_epi32(low, _mm256_mullo_epi32(last, _mm256_set1_epi32(POWER_4)));
+        _mm256_storeu_si256((__m256i *) out, _mm256_shuffle_epi8(value, swap));
+    }
+    return done + (msb ? decode_msb_sse41(digits, groups - done, out) : decode_sse41(digits, groups - done, out));
+}
+
+__attribute__((target("avx2")))
+size_t decode_avx2(const unsigned char *digits, size_t groups, unsigned char *out)
+{
+    return decode_groups_avx2(digits, groups, out, 0);
+}
+
+__attribute__((target("avx2")))
+size_t decode_msb_avx2(const unsigned char *digits, size_t groups, unsigned char *out)
+{
+    return decode_groups_avx2(digits, groups, out, 1);
+}
+
+// digits above MAX_DIGIT are signed bytes above it too, no digit gets past 92
+__attribute__((target("sse4.1")))
+size_t find_special_sse41(const unsigned char *digits, size_t count)
+{
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i value = _mm_loadu_si128((const __m128i *) (digits + i));
+        int mask = _mm_movemask_epi8(_mm_cmpgt_epi8(value, _mm_set1_epi8(MAX_DIGIT)));
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + find_special_scalar(digits + i, count - i);
+}
+
+__attribute__((target("avx2")))
+size_t find_special_avx2(const unsigned char *digits, size_t count)
+{
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i value = _mm256_loadu_si256((const __m256i *) (digits + i));
+        unsigned mask = _mm256_movemask_epi8(_mm256_cmpgt_epi8(value, _mm256_set1_epi8(MAX_DIGIT)));
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + find_special_sse41(digits + i, count - i);
+}
+
+// the compaction of one of the other alphabets
+#define ALPHABET_KERNELS(name, alphabet) \
+    size_t compact_##name##_scalar(const unsigned char *in, size_t length, unsigned char *digits, size_t *consumed) \
+    { \
+        return compact_alphabet_scalar(in, length, digits, consumed, alphabet); \
+    } \
+    __attribute__((target("sse4.1"))) \
+    size_t compact_##name##_sse41(const unsigned char *in, size_t length, unsigned char *digits, size_t *consumed) \
+    { \
+        return compact_groups_sse41(in, length, digits, consumed, alphabet); \
+    } \
+    __attribute__((target("avx2"))) \
+    size_t compact_##name##_avx2(const unsigned char *in, size_t length, unsigned char *digits, size_t *consumed) \
+    { \
+        return compact_groups_avx2(in, length, digits, consumed, alphabet); \
+    }
+
+#else
+
+size_t compact_sse41(const unsigned char *in, size_t length, unsigned char *digits, size_t *consumed)
+{
+    return compact_scalar(in, length, digits, consumed);
+}
+
+size_t compact_avx2(const unsigned char *in, size_t length, unsigned char *digits, size_t *consumed)
+{
+    return compact_scalar(in, length, digits, consumed);
+}
+
+size_t decode_sse41(const unsigned char *digits, size_t groups, unsigned char *out)
+{
+    return decode_scalar(digits, groups, out);
+}
+
+size_t decode_avx2(const unsigned char *digits, size_t groups, unsigned char *out)
+{
+    return decode_scalar(digits, groups, out);
+}
+
+size_t decode_msb_sse41(const unsigned char *digits, size_t groups, unsigned char *out)
+{
+    return decode_msb_scalar(digits, groups, out);
+}
+
+size_t decode_msb_avx2(const unsigned char *digits, size_t groups, unsigned char *out)
+{
+    return decode_msb_scalar(digits, groups, out);
+}
+
+size_t find_special_sse41(const unsigned char *digits, size_t count)
+{
+    return find_special_scalar(digits, count);
+}
+
+size_t find_special_avx2(const unsigned char *digits, size_t count)
+{
+    return find_special_scalar(digits, count);
+}
+
+#define ALPHABET_KERNELS(name, alphabet) \
+    size_t compact_##name##_scalar(const unsigned char *in, size_t length, unsigned char *digits, size_t *consumed) \
+    { \
+        return compact_alphabet_scalar(in, length, digits, consumed, alphabet); \
+    } \
+    size_t compact_##name##_sse41(const unsigned char *in, size_t length, unsigned char *digits, size_t *consumed) \
+    { \
+        return compact_alphabet_scalar(in, length, digits, consumed, alphabet); \
+    } \
+    size_t compact_##name##_avx2(const unsigned char *in, size_t length, unsigned char *digits, size_t *consumed) \
+    { \
+        return compact_alphabet_scalar(in, length, digits, consumed, alphabet); \
+    }
+
+#endif
+
+ALPHABET_KERNELS(z85, ALPHABET_Z85)
+ALPHABET_KERNELS(rfc1924, ALPHABET_RFC1924)
+
+void decode_select(compact_kernel *compact, decode_kernel *decode)
+{
+    *compact = compact_scalar;
+    *decode = decode_scalar;
+#ifdef HAVE_X86_KERNELS
+    build_compact_table();
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        *compact = compact_avx2;
+        *decode = decode_avx2;
+    } else if (__builtin_cpu_supports("sse4.1")) {
+        *compact = compact_sse41;
+        *decode = decode_sse41;
+    }
+#endif
+}
+
+void decode_select_msb(compact_kernel *compact, decode_kernel *decode, find_special_kernel *find)
+{
+    decode_select(compact, decode);
+    *decode = decode_msb_scalar;
+    *find = find_special_scalar;
+#ifdef HAVE_X86_KERNELS
+    if (__builtin_cpu_supports("avx2")) {
+        *decode = decode_msb_avx2;
+        *find = find_special_avx2;
+    } else if (__builtin_cpu_supports("sse4.1")) {
+        *decode = decode_msb_sse41;
+        *find = find_special_sse41;
+    }
+#endif
+}
+
+compact_kernel decode_select_alphabet(int alphabet)
+{
+    int z85 = alphabet == ALPHABET_Z85;
+    build_values(z85 ? z85_values : rfc1924_values, z85 ? Z85_CHARACTERS : RFC1924_CHARACTERS);
+#ifdef HAVE_X86_KERNELS
+    build_compact_table();
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return z85 ? compact_z85_avx2 : compact_rfc1924_avx2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return z85 ? compact_z85_sse41 : compact_rfc1924_sse41;
+    }
+#endif
+    return z85 ? compact_z85_scalar : compact_rfc1924_scalar;
+}
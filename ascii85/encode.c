@@ -0,0 +1,425 @@
+#include "kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+// the characters of the other alphabets, padded to whole vectors
+static const unsigned char z85_characters[96] = Z85_CHARACTERS;
+static const unsigned char rfc1924_characters[96] = RFC1924_CHARACTERS;
+
+static uint32_t load_group(const unsigned char *in)
+{
+    return (uint32_t) in[0] << 24 | (uint32_t) in[1] << 16 | (uint32_t) in[2] << 8 | in[3];
+}
+
+__attribute__((always_inline))
+static inline unsigned char digit_character(uint32_t digit, int alphabet)
+{
+    if (alphabet == ALPHABET_Z85) {
+        return z85_characters[digit];
+    }
+    if (alphabet == ALPHABET_RFC1924) {
+        return rfc1924_characters[digit];
+    }
+    return (unsigned char) (digit + 33);
+}
+
+void encode_output(uint32_t group, unsigned char *out)
+{
+    // output encoded characters, least significant digit first
+    for (int i = 0; i < 5; i++) {
+        uint32_t quotient = (uint32_t) (((uint64_t) group * RECIPROCAL_85) >> RECIPROCAL_SHIFT);
+        out[i] = (unsigned char) (group - quotient * 85 + 33);
+        group = quotient;
+    }
+}
+
+__attribute__((always_inline))
+static inline void output_msb(uint32_t group, unsigned char *out, int alphabet)
+{
+    // output encoded characters, most significant digit first
+    for (int i = 4; i >= 0; i--) {
+        uint32_t quotient = (uint32_t) (((uint64_t) group * RECIPROCAL_85) >> RECIPROCAL_SHIFT);
+        out[i] = digit_character(group - quotient * 85, alphabet);
+        group = quotient;
+    }
+}
+
+void encode_output_msb(uint32_t group, unsigned char *out)
+{
+    output_msb(group, out, ALPHABET_ASCII85);
+}
+
+void encode_scalar(const unsigned char *in, size_t groups, unsigned char *out)
+{
+    for (size_t i = 0; i < groups; i++, in += 4, out += 5) {
+        encode_output(load_group(in), out);
+    }
+}
+
+__attribute__((always_inline))
+static inline void encode_groups_scalar(const unsigned char *in, size_t groups, unsigned char *out, int alphabet)
+{
+    for (size_t i = 0; i < groups; i++, in += 4, out += 5) {
+        output_msb(load_group(in), out, alphabet);
+    }
+}
+
+void encode_msb_scalar(const unsigned char *in, size_t groups, unsigned char *out)
+{
+    encode_groups_scalar(in, groups, out, ALPHABET_ASCII85);
+}
+
+size_t find_zero_scalar(const unsigned char *in, size_t groups, int spaces)
+{
+    for (size_t i = 0; i < groups; i++, in += 4) {
+        uint32_t group = load_group(in);
+        if (group == 0 || (spaces && group == SPACE_GROUP)) {
+            return i;
+        }
+    }
+    return groups;
+}
+
+#ifdef HAVE_X86_KERNELS
+
+// Both kernels work on 128-bit lanes of four groups. The groups are byte
+// swapped to big-endian values, divided by 85 four times with the same
+// reciprocal as encode_output (the fifth digit is what is left), and the
+// digits of a group are packed into one word plus a fifth byte. Two shuffles
+// then interleave them into 20 output bytes per lane. Most significant digit
+// first packs the word the other way round and puts the fifth byte in front.
+// Other alphabets than ASCII85 look the 16 shuffled digits up in their
+// characters with a few more shuffles, and the 4 of the tail one by one.
+
+#define SWAP_MASK 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12
+#define WORD_MASK 0, 1, 2, 3, -1, 4, 5, 6, 7, -1, 8, 9, 10, 11, -1, 12
+#define FIFTH_MASK -1, -1, -1, -1, 0, -1, -1, -1, -1, 4, -1, -1, -1, -1, 8, -1
+#define WORD_MSB_MASK -1, 0, 1, 2, 3, -1, 4, 5, 6, 7, -1, 8, 9, 10, 11, -1
+#define FIFTH_MSB_MASK 0, -1, -1, -1, -1, 4, -1, -1, -1, -1, 8, -1, -1, -1, -1, 12
+
+// _mm_set_epi8 takes the last byte first, the masks above are in memory order
+#define REVERSED(m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12, m13, m14, m15) \
+    m15, m14, m13, m12, m11, m10, m9, m8, m7, m6, m5, m4, m3, m2, m1, m0
+#define MASK(m) REVERSED(m)
+
+__attribute__((target("sse4.1")))
+static __m128i divide_sse41(__m128i value, __m128i reciprocal)
+{
+    // 32x32 -> 64 bit products of the even and the odd lanes
+    __m128i even = _mm_srli_epi64(_mm_mul_epu32(value, reciprocal), RECIPROCAL_SHIFT);
+    __m128i odd = _mm_srli_epi64(_mm_mul_epu32(_mm_srli_epi64(value, 32), reciprocal), RECIPROCAL_SHIFT);
+    return _mm_blend_epi16(even, _mm_slli_epi64(odd, 32), 0xcc);
+}
+
+// a digit minus 16 k saturates past 127 (which shuffles to zero) unless it is in the k-th 16
+__attribute__((target("sse4.1"), always_inline))
+static inline __m128i translate_sse41(__m128i digits, const unsigned char *characters)
+{
+    __m128i result = _mm_setzero_si128();
+    for (int k = 0; k < 6; k++) {
+        __m128i index = _mm_adds_epu8(_mm_sub_epi8(digits, _mm_set1_epi8(16 * k)), _mm_set1_epi8(0x70));
+        result = _mm_or_si128(result,
+            _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (characters + 16 * k)), index));
+    }
+    return result;
+}
+
+__attribute__((target("avx2"), always_inline))
+static inline __m256i translate_avx2(__m256i digits, const unsigned char *characters)
+{
+    __m256i result = _mm256_setzero_si256();
+    for (int k = 0; k < 6; k++) {
+        __m256i index = _mm256_adds_epu8(_mm256_sub_epi8(digits, _mm256_set1_epi8(16 * k)), _mm256_set1_epi8(0x70));
+        __m256i table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) (characters + 16 * k)));
+        result = _mm256_or_si256(result, _mm256_shuffle_epi8(table, index));
+    }
+    return result;
+}
+
+__attribute__((target("sse4.1"), always_inline))
+static inline void encode_lane_sse41(__m128i value, unsigned char *out, int msb, int alphabet)
+{
+    const __m128i reciprocal = _mm_set1_epi32(RECIPROCAL_85);
+    const __m128i base = _mm_set1_epi32(85);
+    __m128i word = _mm_set1_epi32(alphabet == ALPHABET_ASCII85 ? 0x21212121 : 0);
+
+    for (int i = 0; i < 4; i++) {
+        __m128i quotient = divide_sse41(value, reciprocal);
+        __m128i digit = _mm_sub_epi32(value, _mm_mullo_epi32(quotient, base));
+        word = _mm_add_epi32(word, _mm_slli_epi32(digit, msb ? 8 * (3 - i) : 8 * i));
+        value = quotient;
+    }
+    __m128i fifth = alphabet == ALPHABET_ASCII85 ? _mm_add_epi32(value, _mm_set1_epi32(33)) : value;
+
+    __m128i head;
+    uint32_t tail;
+    if (msb) {
+        head = _mm_or_si128(_mm_shuffle_epi8(word, _mm_set_epi8(MASK(WORD_MSB_MASK))),
+            _mm_shuffle_epi8(fifth, _mm_set_epi8(MASK(FIFTH_MSB_MASK))));
+        tail = (uint32_t) _mm_extract_epi32(word, 3);
+    } else {
+        head = _mm_or_si128(_mm_shuffle_epi8(word, _mm_set_epi8(MASK(WORD_MASK))),
+            _mm_shuffle_epi8(fifth, _mm_set_epi8(MASK(FIFTH_MASK))));
+        tail = (uint32_t) _mm_extract_epi32(word, 3) >> 8 | (uint32_t) _mm_extract_epi32(fifth, 3) << 24;
+    }
+    if (alphabet != ALPHABET_ASCII85) {
+        head = translate_sse41(head, alphabet == ALPHABET_Z85 ? z85_characters : rfc1924_characters);
+        for (int i = 0; i < 4; i++) {
+            out[16 + i] = digit_character(tail >> (8 * i) & 0xff, alphabet);
+        }
+    } else {
+        out[16] = tail;
+        out[17] = tail >> 8;
+        out[18] = tail >> 16;
+        out[19] = tail >> 24;
+    }
+    _mm_storeu_si128((__m128i *) out, head);
+}
+
+__attribute__((target("sse4.1"), always_inline))
+static inline void encode_groups_sse41(const unsigned char *in, size_t groups, unsigned char *out, int msb,
+    int alphabet)
+{
+    const __m128i swap = _mm_set_epi8(MASK(SWAP_MASK));
+    for (; groups >= 4; groups -= 4, in += 16, out += 20) {
+        __m128i value = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) in), swap);
+        encode_lane_sse41(value, out, msb, alphabet);
+    }
+    if (alphabet != ALPHABET_ASCII85) {
+        encode_groups_scalar(in, groups, out, alphabet);
+    } else if (msb) {
+        encode_msb_scalar(in, groups, out);
+    } else {
+        encode_scalar(in, groups, out);
+    }
+}
+
+__attribute__((target("sse4.1")))
+void encode_sse41(const unsigned char *in, size_t groups, unsigned char *out)
+{
+    encode_groups_sse41(in, groups, out, 0, ALPHABET_ASCII85);
+}
+
+__attribute__((target("sse4.1")))
+void encode_msb_sse41(const unsigned char *in, size_t groups, unsigned char *out)
+{
+    encode_groups_sse41(in, groups, out, 1, ALPHABET_ASCII85);
+}
+
+__attribute__((target("avx2"), always_inline))
+static inline void encode_groups_avx2(const unsigned char *in, size_t groups, unsigned char *out, int msb,
+    int alphabet)
+{
+    const __m256i swap = _mm256_set_epi8(MASK(SWAP_MASK), MASK(SWAP_MASK));
+    const __m256i word_mask = msb ? _mm256_set_epi8(MASK(WORD_MSB_MASK), MASK(WORD_MSB_MASK))
+        : _mm256_set_epi8(MASK(WORD_MASK), MASK(WORD_MASK));
+    const __m256i fifth_mask = msb ? _mm256_set_epi8(MASK(FIFTH_MSB_MASK), MASK(FIFTH_MSB_MASK))
+        : _mm256_set_epi8(MASK(FIFTH_MASK), MASK(FIFTH_MASK));
+    const __m256i reciprocal = _mm256_set1_epi32(RECIPROCAL_85);
+    const __m256i base = _mm256_set1_epi32(85);
+
+    for (; groups >= 8; groups -= 8, in += 32, out += 40) {
+        __m256i value = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *) in), swap);
+        __m256i word = _mm256_set1_epi32(alphabet == ALPHABET_ASCII85 ? 0x21212121 : 0);
+
+        for (int i = 0; i < 4; i++) {
+            __m256i even = _mm256_srli_epi64(_mm256_mul_epu32(value, reciprocal), RECIPROCAL_SHIFT);
+            __m256i odd = _mm256_srli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(value, 32), reciprocal),
+                RECIPROCAL_SHIFT);
+            __m256i quotient = _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xaa);
+            __m256i digit = _mm256_sub_epi32(value, _mm256_mullo_epi32(quotient, base));
+            word = _mm256_add_epi32(word, _mm256_slli_epi32(digit, msb ? 8 * (3 - i) : 8 * i));
+            value = quotient;
+        }
+        __m256i fifth = alphabet == ALPHABET_ASCII85 ? _mm256_add_epi32(value, _mm256_set1_epi32(33)) : value;
+
+        // each 128-bit lane turns into 16 shuffled bytes and a 4 byte tail
+        __m256i head = _mm256_or_si256(_mm256_shuffle_epi8(word, word_mask), _mm256_shuffle_epi8(fifth, fifth_mask));
+        __m256i tail = msb ? word : _mm256_or_si256(_mm256_srli_epi32(word, 8), _mm256_slli_epi32(fifth, 24));
+        uint32_t low_tail = (uint32_t) _mm256_extract_epi32(tail, 3);
+        uint32_t high_tail = (uint32_t) _mm256_extract_epi32(tail, 7);
+        if (alphabet != ALPHABET_ASCII85) {
+            head = translate_avx2(head, alphabet == ALPHABET_Z85 ? z85_characters : rfc1924_characters);
+            for (int i = 0; i < 4; i++) {
+                out[16 + i] = digit_character(low_tail >> (8 * i) & 0xff, alphabet);
+                out[36 + i] = digit_character(high_tail >> (8 * i) & 0xff, alphabet);
+            }
+        } else {
+            for (int i = 0; i < 4; i++) {
+                out[16 + i] = low_tail >> (8 * i);
+                out[36 + i] = high_tail >> (8 * i);
+            }
+        }
+        _mm_storeu_si128((__m128i *) out, _mm256_castsi256_si128(head));
+        _mm_storeu_si128((__m128i *) (out + 20), _mm256_extracti128_si256(head, 1));
+    }
+    if (alphabet != ALPHABET_ASCII85) {
+        encode_groups_sse41(in, groups, out, msb, alphabet);
+    } else if (msb) {
+        encode_msb_sse41(in, groups, out);
+    } else {
+        encode_sse41(in, groups, out);
+    }
+}
+
+__attribute__((target("avx2")))
+void encode_avx2(const unsigned char *in, size_t groups, unsigned char *out)
+{
+    encode_groups_avx2(in, groups, out, 0, ALPHABET_ASCII85);
+}
+
+__attribute__((target("avx2")))
+void encode_msb_avx2(const unsigned char *in, size_t groups, unsigned char *out)
+{
+    encode_groups_avx2(in, groups, out, 1, ALPHABET_ASCII85);
+}
+
+// zero groups (and groups of spaces) are looked for four and eight groups at a time
+__attribute__((target("sse4.1")))
+size_t find_zero_sse41(const unsigned char *in, size_t groups, int spaces)
+{
+    const __m128i space = spaces ? _mm_set1_epi32(SPACE_GROUP) : _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 4 <= groups; i += 4) {
+        __m128i value = _mm_loadu_si128((const __m128i *) (in + 4 * i));
+        __m128i found = _mm_or_si128(_mm_cmpeq_epi32(value, _mm_setzero_si128()), _mm_cmpeq_epi32(value, space));
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(found));
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + find_zero_scalar(in + 4 * i, groups - i, spaces);
+}
+
+__attribute__((target("avx2")))
+size_t find_zero_avx2(const unsigned char *in, size_t groups, int spaces)
+{
+    const __m256i space = spaces ? _mm256_set1_epi32(SPACE_GROUP) : _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= groups; i += 8) {
+        __m256i value = _mm256_loadu_si256((const __m256i *) (in + 4 * i));
+        __m256i found = _mm256_or_si256(_mm256_cmpeq_epi32(value, _mm256_setzero_si256()),
+            _mm256_cmpeq_epi32(value, space));
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(found));
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + find_zero_sse41(in + 4 * i, groups - i, spaces);
+}
+
+// the kernels of one of the other alphabets, most significant digit first
+#define ALPHABET_KERNELS(name, alphabet) \
+    void encode_##name##_scalar(const unsigned char *in, size_t groups, unsigned char *out) \
+    { \
+        encode_groups_scalar(in, groups, out, alphabet); \
+    } \
+    __attribute__((target("sse4.1"))) \
+    void encode_##name##_sse41(const unsigned char *in, size_t groups, unsigned char *out) \
+    { \
+        encode_groups_sse41(in, groups, out, 1, alphabet); \
+    } \
+    __attribute__((target("avx2"))) \
+    void encode_##name##_avx2(const unsigned char *in, size_t groups, unsigned char *out) \
+    { \
+        encode_groups_avx2(in, groups, out, 1, alphabet); \
+    }
+
+#else
+
+void encode_sse41(const unsigned char *in, size_t groups, unsigned char *out)
+{
+    encode_scalar(in, groups, out);
+}
+
+void encode_avx2(const unsigned char *in, size_t groups, unsigned char *out)
+{
+    encode_scalar(in, groups, out);
+}
+
+void encode_msb_sse41(const unsigned char *in, size_t groups, unsigned char *out)
+{
+    encode_msb_scalar(in, groups, out);
+}
+
+void encode_msb_avx2(const unsigned char *in, size_t groups, unsigned char *out)
+{
+    encode_msb_scalar(in, groups, out);
+}
+
+size_t find_zero_sse41(const unsigned char *in, size_t groups, int spaces)
+{
+    return find_zero_scalar(in, groups, spaces);
+}
+
+size_t find_zero_avx2(const unsigned char *in, size_t groups, int spaces)
+{
+    return find_zero_scalar(in, groups, spaces);
+}
+
+#define ALPHABET_KERNELS(name, alphabet) \
+    void encode_##name##_scalar(const unsigned char *in, size_t groups, unsigned char *out) \
+    { \
+        encode_groups_scalar(in, groups, out, alphabet); \
+    } \
+    void encode_##name##_sse41(const unsigned char *in, size_t groups, unsigned char *out) \
+    { \
+        encode_groups_scalar(in, groups, out, alphabet); \
+    } \
+    void encode_##name##_avx2(const unsigned char *in, size_t groups, unsigned char *out) \
+    { \
+        encode_groups_scalar(in, groups, out, alphabet); \
+    }
+
+#endif
+
+ALPHABET_KERNELS(z85, ALPHABET_Z85)
+ALPHABET_KERNELS(rfc1924, ALPHABET_RFC1924)
+
+encode_kernel encode_select(void)
+{
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return encode_avx2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return encode_sse41;
+    }
+#endif
+    return encode_scalar;
+}
+
+void encode_select_msb(encode_kernel *encode, find_zero_kernel *find)
+{
+    *encode = encode_msb_scalar;
+    *find = find_zero_scalar;
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        *encode = encode_msb_avx2;
+        *find = find_zero_avx2;
+    } else if (__builtin_cpu_supports("sse4.1")) {
+        *encode = encode_msb_sse41;
+        *find = find_zero_sse41;
+    }
+#endif
+}
+
+encode_kernel encode_select_alphabet(int alphabet)
+{
+    int z85 = alphabet == ALPHABET_Z85;
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return z85 ? encode_z85_avx2 : encode_rfc1924_avx2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return z85 ? encode_z85_sse41 : encode_rfc1924_sse41;
+    }
+#endif
+    return z85 ? encode_z85_scalar : encode_rfc1924_scalar;
+}
@@ -0,0 +1,100 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 85 * RECIPROCAL_85 is just above 2^RECIPROCAL_SHIFT, which keeps
+// (x * RECIPROCAL_85) >> RECIPROCAL_SHIFT equal to x / 85 for every 32-bit x
+#define RECIPROCAL_85 3233857729u
+#define RECIPROCAL_SHIFT 38
+
+// encodes `groups` big-endian 4-byte groups into 5 characters each
+typedef void (*encode_kernel)(const unsigned char *in, size_t groups, unsigned char *out);
+
+// moves the digit values of the characters to `digits` without whitespace and
+// returns their number; stops at an invalid character, `consumed` tells where
+typedef size_t (*compact_kernel)(const unsigned char *in, size_t length, unsigned char *digits, size_t *consumed);
+
+// decodes groups of 5 digits into 4 bytes each; returns the number of groups
+// before the first one above 0xFFFFFFFF
+typedef size_t (*decode_kernel)(const unsigned char *digits, size_t groups, unsigned char *out);
+
+// returns the index of the first all zero group, or group of spaces if asked for
+typedef size_t (*find_zero_kernel)(const unsigned char *in, size_t groups, int spaces);
+
+// returns the index of the first digit above MAX_DIGIT, the z and y shortcuts
+// and the characters no group can contain
+typedef size_t (*find_special_kernel)(const unsigned char *digits, size_t count);
+
+// continues a CRC-32C over the data, the CRC is kept without the final inversion
+typedef uint32_t (*crc_kernel)(uint32_t crc, const unsigned char *data, size_t length);
+
+// the digit values of the characters 'u', 'y' and 'z', and four spaces as a group
+#define MAX_DIGIT 84
+#define SPACES_DIGIT 88
+#define ZERO_DIGIT 89
+#define SPACE_GROUP 0x20202020u
+
+// compact kernels may write up to this many bytes past the digits they return
+#define COMPACT_SLACK 32
+
+// The digit alphabets. The kernels take the alphabet as a constant and are
+// generated once per alphabet, so the ASCII85 one keeps its plain offset and
+// the others translate digits with a few shuffles of their characters (and
+// back with the reverse table, which holds the digit plus one per character).
+#define ALPHABET_ASCII85 0
+#define ALPHABET_Z85 1
+#define ALPHABET_RFC1924 2
+#define ALPHABETS 3
+#define Z85_CHARACTERS "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ.-:+=^!/*?&<>()[]{}@%$#"
+#define RFC1924_CHARACTERS "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz!#$%&()*+-;<=>?@^_`{|}~"
+
+// function headers
+void encode_output(uint32_t group, unsigned char *out);
+void encode_scalar(const unsigned char *in, size_t groups, unsigned char *out);
+void encode_sse41(const unsigned char *in, size_t groups, unsigned char *out);
+void encode_avx2(const unsigned char *in, size_t groups, unsigned char *out);
+encode_kernel encode_select(void);
+void encode_output_msb(uint32_t group, unsigned char *out);
+void encode_msb_scalar(const unsigned char *in, size_t groups, unsigned char *out);
+void encode_msb_sse41(const unsigned char *in, size_t groups, unsigned char *out);
+void encode_msb_avx2(const unsigned char *in, size_t groups, unsigned char *out);
+size_t find_zero_scalar(const unsigned char *in, size_t groups, int spaces);
+size_t find_zero_sse41(const unsigned char *in, size_t groups, int spaces);
+size_t find_zero_avx2(const unsigned char *in, size_t groups, int spaces);
+void encode_select_msb(encode_kernel *encode, find_zero_kernel *find);
+void encode_z85_scalar(const unsigned char *in, size_t groups, unsigned char *out);
+void encode_z85_sse41(const unsigned char *in, size_t groups, unsigned char *out);
+void encode_z85_avx2(const unsigned char *in, size_t groups, unsigned char *out);
+void encode_rfc1924_scalar(const unsigned char *in, size_t groups, unsigned char *out);
+void encode_rfc1924_sse41(const unsigned char *in, size_t groups, unsigned char *out);
+void encode_rfc1924_avx2(const unsigned char *in, size_t groups, unsigned char *out);
+encode_kernel encode_select_alphabet(int alphabet);
+void decode_output(uint32_t group, unsigned char *out);
+size_t compact_scalar(const unsigned char *in, size_t length, unsigned char *digits, size_t *consumed);
+size_t compact_sse41(const unsigned char *in, size_t length, unsigned char *digits, size_t *consumed);
+size_t compact_avx2(const unsigned char *in, size_t length, unsigned char *digits, size_t *consumed);
+size_t decode_scalar(const unsigned char *digits, size_t groups, unsigned char *out);
+size_t decode_sse41(const unsigned char *digits, size_t groups, unsigned char *out);
+size_t decode_avx2(const unsigned char *digits, size_t groups, unsigned char *out);
+void decode_select(compact_kernel *compact, decode_kernel *decode);
+size_t decode_msb_scalar(const unsigned char *digits, size_t groups, unsigned char *out);
+size_t decode_msb_sse41(const unsigned char *digits, size_t groups, unsigned char *out);
+size_t decode_msb_avx2(const unsigned char *digits, size_t groups, unsigned char *out);
+size_t find_special_scalar(const unsigned char *digits, size_t count);
+size_t find_special_sse41(const unsigned char *digits, size_t count);
+size_t find_special_avx2(const unsigned char *digits, size_t count);
+void decode_select_msb(compact_kernel *compact, decode_kernel *decode, find_special_kernel *find);
+size_t compact_z85_scalar(const unsigned char *in, size_t length, unsigned char *digits, size_t *consumed);
+size_t compact_z85_sse41(const unsigned char *in, size_t length, unsigned char *digits, size_t *consumed);
+size_t compact_z85_avx2(const unsigned char *in, size_t length, unsigned char *digits, size_t *consumed);
+size_t compact_rfc1924_scalar(const unsigned char *in, size_t length, unsigned char *digits, size_t *consumed);
+size_t compact_rfc1924_sse41(const unsigned char *in, size_t length, unsigned char *digits, size_t *consumed);
+size_t compact_rfc1924_avx2(const unsigned char *in, size_t length, unsigned char *digits, size_t *consumed);
+compact_kernel decode_select_alphabet(int alphabet);
+uint32_t crc32c_scalar(uint32_t crc, const unsigned char *data, size_t length);
+uint32_t crc32c_sse42(uint32_t crc, const unsigned char *data, size_t length);
+crc_kernel crc32c_select(void);
+
+#endif // KERNELS_H
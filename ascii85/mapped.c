@@ -0,0 +1,291 @@
+#define _GNU_SOURCE
+#include "mapped.h"
+#include "ascii85.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// output buffer size, and the pipe size asked for so one write fits
+#define SINK_SIZE (1 << 20)
+
+// room a buffer needs for the codecs to take at least one more input byte
+#define SINK_MINIMUM 8
+
+struct mapping {
+    void *address;
+    size_t length;
+    unsigned char *data;
+    size_t size;
+    off_t base;
+};
+
+// output that is not a mappable file goes through one buffer and write calls,
+// which copy it, so the buffer can be refilled right away
+struct sink {
+    unsigned char *buffer;
+    size_t fill;
+};
+
+// maps the region of `fd` from `base` on, mmap wants a page aligned offset
+static int map_region(struct mapping *mapping, int fd, off_t base, size_t size, int prot)
+{
+    off_t delta = base % sysconf(_SC_PAGESIZE);
+    mapping->base = base;
+    mapping->size = size;
+    mapping->length = delta + size;
+    mapping->address = NULL;
+    mapping->data = NULL;
+    if (size == 0) {
+        return 0;
+    }
+    mapping->address = mmap(NULL, mapping->length, prot, MAP_SHARED, fd, base - delta);
+    if (mapping->address == MAP_FAILED) {
+        mapping->address = NULL;
+        return 1;
+    }
+    mapping->data = (unsigned char *) mapping->address + delta;
+    return 0;
+}
+
+static void unmap_region(struct mapping *mapping)
+{
+    if (mapping->address != NULL) {
+        munmap(mapping->address, mapping->length);
+    }
+}
+
+static int map_input(struct mapping *input)
+{
+    struct stat info;
+    off_t base = lseek(STDIN_FILENO, 0, SEEK_CUR);
+    if (base < 0 || fstat(STDIN_FILENO, &info) != 0) {
+        return 1;
+    }
+    size_t size = info.st_size > base ? (size_t) (info.st_size - base) : 0;
+    if (map_region(input, STDIN_FILENO, base, size, PROT_READ) != 0) {
+        return 1;
+    }
+    if (input->address != NULL) {
+        madvise(input->address, input->length, MADV_SEQUENTIAL);
+    }
+
+    // leave stdin where reading it would have left it
+    lseek(STDIN_FILENO, base + size, SEEK_SET);
+    return 0;
+}
+
+// check if stdout is a regular file that can be mapped for writing
+static int output_mappable(void)
+{
+    struct stat info;
+    int flags = fcntl(STDOUT_FILENO, F_GETFL);
+    return fstat(STDOUT_FILENO, &info) == 0 && S_ISREG(info.st_mode)
+        && flags >= 0 && (flags & O_ACCMODE) == O_RDWR && !(flags & O_APPEND);
+}
+
+// preallocates and maps `size` bytes of stdout at its file position
+static int map_output(struct mapping *output, size_t size)
+{
+    off_t base = lseek(STDOUT_FILENO, 0, SEEK_CUR);
+    if (base < 0) {
+        return 1;
+    }
+
+    // fall back to a sparse file where the file system can't preallocate
+    if (size != 0 && fallocate(STDOUT_FILENO, 0, base, size) != 0) {
+        struct stat info;
+        if ((errno != EOPNOTSUPP && errno != ENOSYS) || fstat(STDOUT_FILENO, &info) != 0
+            || (info.st_size < base + (off_t) size && ftruncate(STDOUT_FILENO, base + size) != 0)) {
+            return 1;
+        }
+    }
+    return map_region(output, STDOUT_FILENO, base, size, PROT_READ | PROT_WRITE);
+}
+
+// drops what was preallocated but not written and moves stdout past the output
+static int finish_output(struct mapping *output, size_t written)
+{
+    unmap_region(output);
+    if (written < output->size && ftruncate(STDOUT_FILENO, output->base + written) != 0) {
+        return 1;
+    }
+    return lseek(STDOUT_FILENO, output->base + written, SEEK_SET) < 0;
+}
+
+static int sink_open(struct sink *sink)
+{
+    // a larger pipe takes a whole buffer per write
+    struct stat info;
+    if (fstat(STDOUT_FILENO, &info) == 0 && S_ISFIFO(info.st_mode)) {
+        fcntl(STDOUT_FILENO, F_SETPIPE_SZ, SINK_SIZE);
+    }
+    sink->fill = 0;
+    sink->buffer = malloc(SINK_SIZE);
+    return sink->buffer == NULL;
+}
+
+static int sink_flush(struct sink *sink)
+{
+    unsigned char *buffer = sink->buffer;
+    size_t size = sink->fill;
+    sink->fill = 0;
+    while (size > 0) {
+        ssize_t written = write(STDOUT_FILENO, buffer, size);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return 1;
+        }
+        buffer += written;
+        size -= written;
+    }
+    return 0;
+}
+
+// hands out the free part of the buffer, flushing it when less than `needed` is left
+static unsigned char *sink_space(struct sink *sink, size_t needed, size_t *room)
+{
+    if (SINK_SIZE - sink->fill < needed && sink_flush(sink) != 0) {
+        return NULL;
+    }
+    *room = SINK_SIZE - sink->fill;
+    return sink->buffer + sink->fill;
+}
+
+static int sink_close(struct sink *sink, int flush)
+{
+    int retcode = flush ? sink_flush(sink) : 0;
+    free(sink->buffer);
+    return retcode;
+}
+
+int mapped_supported(void)
+{
+    struct stat input;
+    return fstat(STDIN_FILENO, &input) == 0 && S_ISREG(input.st_mode);
+}
+
+int encode_mapped(int flags)
+{
+    struct mapping input;
+    struct ascii85_encoder encoder;
+    size_t length;
+    if (map_input(&input) != 0) {
+        return 1;
+    }
+    ascii85_encoder_init(&encoder, flags);
+
+    // the encoded size is known (z shortcuts only make it smaller), the whole output is written in place
+    if (output_mappable()) {
+        struct mapping output;
+        size_t size = ascii85_encoded_size(input.size, flags) + 1;
+        int retcode = map_output(&output, size);
+        if (retcode == 0) {
+            size_t written;
+            ascii85_encode_update(&encoder, input.data, input.size, output.data, size, &written);
+            ascii85_encode_finish(&encoder, output.data + written, size - written, &length);
+            written += length;
+            output.data[written++] = '\n';
+            retcode = finish_output(&output, written);
+        }
+        unmap_region(&input);
+        return retcode;
+    }
+
+    struct sink sink;
+    if (sink_open(&sink) != 0) {
+        unmap_region(&input);
+        return 1;
+    }
+    size_t offset = 0;
+    size_t room;
+    unsigned char *out;
+    int retcode = 0;
+    while (retcode == 0 && offset < input.size) {
+        if ((out = sink_space(&sink, SINK_MINIMUM, &room)) == NULL) {
+            retcode = 1;
+            break;
+        }
+
+        // as much input as the buffer has room for
+        size_t piece = ascii85_encode_input_limit(&encoder, room);
+        if (piece > input.size - offset) {
+            piece = input.size - offset;
+        }
+        ascii85_encode_update(&encoder, input.data + offset, piece, out, room, &length);
+        sink.fill += length;
+        offset += piece;
+    }
+
+    // leftover group and newline
+    if (retcode == 0 && (out = sink_space(&sink, ascii85_encode_finish_size(&encoder) + 1, &room)) != NULL) {
+        ascii85_encode_finish(&encoder, out, room, &length);
+        out[length] = '\n';
+        sink.fill += length + 1;
+    } else {
+        retcode = 1;
+    }
+    retcode |= sink_close(&sink, retcode == 0);
+    unmap_region(&input);
+    return retcode;
+}
+
+int decode_mapped(int flags)
+{
+    struct mapping input;
+    static struct ascii85_decoder decoder;
+    enum ascii85_status status = ASCII85_OK;
+    size_t length;
+    if (map_input(&input) != 0) {
+        return 1;
+    }
+    ascii85_decoder_init(&decoder, flags);
+
+    // room for input without whitespace, cut down to what was decoded afterwards;
+    // z shortcuts make that bound too loose to preallocate
+    if (!(flags & ASCII85_ADOBE) && output_mappable()) {
+        struct mapping output;
+        size_t size = ascii85_decoded_size_max(input.size, flags);
+        int retcode = map_output(&output, size);
+        if (retcode == 0) {
+            status = ascii85_decode_update(&decoder, input.data, input.size, output.data, size, &length);
+            retcode = finish_output(&output, length);
+        }
+        unmap_region(&input);
+        return retcode != 0 || status != ASCII85_OK || ascii85_decode_finish(&decoder) != ASCII85_OK;
+    }
+
+    struct sink sink;
+    if (sink_open(&sink) != 0) {
+        unmap_region(&input);
+        return 1;
+    }
+    size_t offset = 0;
+    size_t room;
+    unsigned char *out;
+    int retcode = 0;
+    while (status == ASCII85_OK && offset < input.size) {
+        if ((out = sink_space(&sink, SINK_MINIMUM, &room)) == NULL) {
+            retcode = 1;
+            break;
+        }
+
+        // whitespace only makes the output smaller than the room it was given
+        size_t piece = ascii85_decode_input_limit(&decoder, room);
+        if (piece > input.size - offset) {
+            piece = input.size - offset;
+        }
+
+        // what was decoded before an error is still written
+        status = ascii85_decode_update(&decoder, input.data + offset, piece, out, room, &length);
+        sink.fill += length;
+        offset += piece;
+    }
+    retcode |= sink_close(&sink, retcode == 0);
+    unmap_region(&input);
+    return retcode != 0 || status != ASCII85_OK || ascii85_decode_finish(&decoder) != ASCII85_OK;
+}
@@ -0,0 +1,13 @@
+#ifndef MAPPED_H
+#define MAPPED_H
+
+// encoding and decoding of a regular file on stdin through a memory mapping;
+// a regular output file is preallocated and mapped too, a pipe is fed with
+// vmsplice and anything else gets plain writes
+
+// function headers
+int mapped_supported(void);
+int encode_mapped(int flags);
+int decode_mapped(int flags);
+
+#endif // MAPPED_H
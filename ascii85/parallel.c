@@ -0,0 +1,310 @@
+#define _GNU_SOURCE
+#include "parallel.h"
+#include "kernels.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// input bytes per chunk, a multiple of 4 so encode chunks hold whole groups
+#define CHUNK_SIZE (8 << 20)
+
+// input read at once when a decode group continues in the next chunk
+#define LOOKAHEAD_SIZE 4096
+
+struct pool {
+    int threads;
+    size_t chunks;
+    size_t next;
+    int failed;
+    void (*work)(struct pool *pool, size_t chunk, unsigned char *in, unsigned char *out);
+    off_t input_base;
+    off_t input_size;
+    off_t output_base;
+    encode_kernel encode;
+    compact_kernel compact;
+    decode_kernel decode;
+
+    // decode bookkeeping, digits per chunk and where the first group starts
+    size_t *digits;
+    uint64_t *first_digit;
+    uint64_t total_groups;
+    uint64_t failed_group;
+    size_t invalid_chunk;
+};
+
+static int read_at(int fd, unsigned char *buffer, size_t size, off_t offset)
+{
+    size_t done = 0;
+    while (done < size) {
+        ssize_t got = pread(fd, buffer + done, size - done, offset + done);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return 1;
+        }
+        done += got;
+    }
+    return 0;
+}
+
+static int write_at(int fd, const unsigned char *buffer, size_t size, off_t offset)
+{
+    size_t done = 0;
+    while (done < size) {
+        ssize_t written = pwrite(fd, buffer + done, size - done, offset + done);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return 1;
+        }
+        done += written;
+    }
+    return 0;
+}
+
+static size_t chunk_length(const struct pool *pool, size_t chunk)
+{
+    off_t start = (off_t) chunk * CHUNK_SIZE;
+    return pool->input_size - start < CHUNK_SIZE ? (size_t) (pool->input_size - start) : CHUNK_SIZE;
+}
+
+static void *worker(void *arg)
+{
+    struct pool *pool = arg;
+    unsigned char *in = malloc(CHUNK_SIZE + 4 + LOOKAHEAD_SIZE + COMPACT_SLACK);
+    unsigned char *out = malloc(CHUNK_SIZE / 4 * 5 + COMPACT_SLACK);
+    if (in == NULL || out == NULL) {
+        __atomic_store_n(&pool->failed, 1, __ATOMIC_RELAXED);
+    }
+
+    // take chunks until none are left or something failed
+    while (in != NULL && out != NULL && !__atomic_load_n(&pool->failed, __ATOMIC_RELAXED)) {
+        size_t chunk = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+        if (chunk >= pool->chunks) {
+            break;
+        }
+        pool->work(pool, chunk, in, out);
+    }
+
+    free(in);
+    free(out);
+    return NULL;
+}
+
+// runs the work on every chunk with the calling thread as one of the workers
+static int run_pool(struct pool *pool, void (*work)(struct pool *, size_t, unsigned char *, unsigned char *))
+{
+    pthread_t *threads = malloc(pool->threads * sizeof(pthread_t));
+    if (threads == NULL) {
+        return 1;
+    }
+    pool->work = work;
+    pool->next = 0;
+
+    int started = 0;
+    while (started < pool->threads - 1 && pthread_create(&threads[started], NULL, worker, pool) == 0) {
+        started++;
+    }
+    worker(pool);
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    return pool->failed;
+}
+
+static void encode_chunk(struct pool *pool, size_t chunk, unsigned char *in, unsigned char *out)
+{
+    size_t length = chunk_length(pool, chunk);
+    if (read_at(STDIN_FILENO, in, length, pool->input_base + (off_t) chunk * CHUNK_SIZE) != 0) {
+        __atomic_store_n(&pool->failed, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    // only the last chunk can end in a partial group, it is zero padded
+    size_t groups = (length + 3) / 4;
+    for (size_t i = length; i < groups * 4; i++) {
+        in[i] = 0;
+    }
+    pool->encode(in, groups, out);
+
+    off_t offset = pool->output_base + (off_t) chunk * (CHUNK_SIZE / 4 * 5);
+    if (write_at(STDOUT_FILENO, out, groups * 5, offset) != 0) {
+        __atomic_store_n(&pool->failed, 1, __ATOMIC_RELAXED);
+    }
+}
+
+// first pass: count the digits of every chunk and find invalid characters
+static void count_chunk(struct pool *pool, size_t chunk, unsigned char *in, unsigned char *out)
+{
+    size_t length = chunk_length(pool, chunk);
+    size_t consumed;
+    if (read_at(STDIN_FILENO, in, length, pool->input_base + (off_t) chunk * CHUNK_SIZE) != 0) {
+        __atomic_store_n(&pool->failed, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    pool->digits[chunk] = pool->compact(in, length, out, &consumed);
+
+    // remember the earliest chunk with an invalid character
+    if (consumed != length) {
+        size_t current = __atomic_load_n(&pool->invalid_chunk, __ATOMIC_RELAXED);
+        while (chunk < current
+            && !__atomic_compare_exchange_n(&pool->invalid_chunk, &current, chunk, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        }
+    }
+}
+
+// second pass: decode the groups starting in the chunk, the last one may need digits from the next chunks
+static void decode_chunk(struct pool *pool, size_t chunk, unsigned char *in, unsigned char *out)
+{
+    uint64_t first_group = (pool->first_digit[chunk] + 4) / 5;
+    uint64_t end_group = (pool->first_digit[chunk + 1] + 4) / 5;
+    if (end_group > pool->total_groups) {
+        end_group = pool->total_groups;
+    }
+    if (first_group >= end_group) {
+        return;
+    }
+
+    size_t length = chunk_length(pool, chunk);
+    off_t offset = pool->input_base + (off_t) chunk * CHUNK_SIZE;
+    size_t consumed;
+    if (read_at(STDIN_FILENO, in, length, offset) != 0) {
+        __atomic_store_n(&pool->failed, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    // the digits live in `in` itself, compacting never moves a byte forward
+    size_t skip = first_group * 5 - pool->first_digit[chunk];
+    size_t needed = (end_group - first_group) * 5 + skip;
+    size_t count = pool->compact(in, length, in, &consumed);
+    offset += length;
+    while (count < needed) {
+        size_t piece = pool->input_base + pool->input_size - offset < LOOKAHEAD_SIZE
+            ? (size_t) (pool->input_base + pool->input_size - offset) : LOOKAHEAD_SIZE;
+        if (piece == 0 || read_at(STDIN_FILENO, in + count, piece, offset) != 0) {
+            __atomic_store_n(&pool->failed, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        count += pool->compact(in + count, piece, in + count, &consumed);
+        offset += piece;
+        if (consumed != piece && count < needed) {
+            __atomic_store_n(&pool->failed, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+
+    size_t groups = end_group - first_group;
+    size_t decoded = pool->decode(in + skip, groups, out);
+    if (decoded != groups) {
+
+        // keep the earliest group above 0xFFFFFFFF
+        uint64_t failed = first_group + decoded;
+        uint64_t current = __atomic_load_n(&pool->failed_group, __ATOMIC_RELAXED);
+        while (failed < current
+            && !__atomic_compare_exchange_n(&pool->failed_group, &current, failed, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        }
+    }
+    if (write_at(STDOUT_FILENO, out, decoded * 4, pool->output_base + (off_t) first_group * 4) != 0) {
+        __atomic_store_n(&pool->failed, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static int setup_pool(struct pool *pool, int threads)
+{
+    struct stat info;
+    pool->threads = threads;
+    pool->failed = 0;
+    pool->input_base = lseek(STDIN_FILENO, 0, SEEK_CUR);
+    pool->output_base = lseek(STDOUT_FILENO, 0, SEEK_CUR);
+    if (fstat(STDIN_FILENO, &info) != 0 || pool->input_base < 0 || pool->output_base < 0) {
+        return 1;
+    }
+    pool->input_size = info.st_size > pool->input_base ? info.st_size - pool->input_base : 0;
+    pool->chunks = (pool->input_size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    return 0;
+}
+
+int parallel_supported(void)
+{
+    struct stat input;
+    struct stat output;
+
+    // chunks are read and written at their own offsets, so both ends have to be
+    // regular files, and appending would ignore the offsets
+    int flags = fcntl(STDOUT_FILENO, F_GETFL);
+    return fstat(STDIN_FILENO, &input) == 0 && fstat(STDOUT_FILENO, &output) == 0
+        && S_ISREG(input.st_mode) && S_ISREG(output.st_mode) && flags >= 0 && !(flags & O_APPEND);
+}
+
+int encode_parallel(int threads)
+{
+    struct pool pool;
+    if (setup_pool(&pool, threads) != 0) {
+        return 1;
+    }
+    pool.encode = encode_select();
+    if (run_pool(&pool, encode_chunk) != 0) {
+        return 1;
+    }
+
+    // the newline goes after the last group, the file position after it
+    off_t end = pool.output_base + (pool.input_size + 3) / 4 * 5;
+    unsigned char newline = '\n';
+    if (write_at(STDOUT_FILENO, &newline, 1, end) != 0 || lseek(STDOUT_FILENO, end + 1, SEEK_SET) < 0) {
+        return 1;
+    }
+    lseek(STDIN_FILENO, pool.input_base + pool.input_size, SEEK_SET);
+    return 0;
+}
+
+int decode_parallel(int threads)
+{
+    struct pool pool;
+    if (setup_pool(&pool, threads) != 0) {
+        return 1;
+    }
+    decode_select(&pool.compact, &pool.decode);
+    pool.digits = calloc(pool.chunks + 1, sizeof(size_t));
+    pool.first_digit = calloc(pool.chunks + 1, sizeof(uint64_t));
+    pool.invalid_chunk = SIZE_MAX;
+    pool.failed_group = UINT64_MAX;
+    int retcode = 1;
+    if (pool.digits == NULL || pool.first_digit == NULL || run_pool(&pool, count_chunk) != 0) {
+        goto cleanup;
+    }
+
+    // digits after an invalid character don't count
+    size_t last = pool.invalid_chunk < pool.chunks ? pool.invalid_chunk + 1 : pool.chunks;
+    for (size_t i = 0; i < pool.chunks; i++) {
+        pool.first_digit[i + 1] = pool.first_digit[i] + (i < last ? pool.digits[i] : 0);
+    }
+    pool.total_groups = pool.first_digit[pool.chunks] / 5;
+    if (run_pool(&pool, decode_chunk) != 0) {
+        goto cleanup;
+    }
+
+    // everything from the first bad group on is cut off, like the sequential decoder stops there
+    uint64_t groups = pool.failed_group < pool.total_groups ? pool.failed_group : pool.total_groups;
+    off_t end = pool.output_base + (off_t) groups * 4;
+    if (ftruncate(STDOUT_FILENO, end) != 0 || lseek(STDOUT_FILENO, end, SEEK_SET) < 0) {
+        goto cleanup;
+    }
+    lseek(STDIN_FILENO, pool.input_base + pool.input_size, SEEK_SET);
+
+    // check for invalid characters, overflow and input length not divisible by 5
+    if (pool.invalid_chunk == SIZE_MAX && pool.failed_group == UINT64_MAX && pool.first_digit[pool.chunks] % 5 == 0) {
+        retcode = 0;
+    }
+
+cleanup:
+    free(pool.digits);
+    free(pool.first_digit);
+    return retcode;
+}
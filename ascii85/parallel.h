@@ -0,0 +1,12 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+// chunked encoding and decoding of a regular file on stdin into a regular
+// file on stdout, each chunk is written at its own offset with pwrite
+
+// function headers
+int parallel_supported(void);
+int encode_parallel(int threads);
+int decode_parallel(int threads);
+
+#endif // PARALLEL_H
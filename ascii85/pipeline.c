@@ -0,0 +1,353 @@
+#define _GNU_SOURCE
+#include "pipeline.h"
+#include "ascii85.h"
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// input bytes per block, a multiple of 4 so encode blocks hold whole groups
+#define BLOCK_SIZE (1 << 20)
+
+// how often a reader waiting for input looks at the stop flag
+#define POLL_MILLISECONDS 100
+
+enum block_state {
+    BLOCK_FREE,
+    BLOCK_FILLED,
+    BLOCK_BUSY,
+    BLOCK_DONE
+};
+
+struct block {
+    enum block_state state;
+    size_t sequence;
+    int last;
+    int failed;
+    unsigned char *in;
+    size_t in_len;
+    unsigned char *out;
+    size_t out_len;
+};
+
+// block n of the stream lives in blocks[n % count], it goes from the reader
+// to a worker to the writer and back to the reader
+struct pipeline {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    struct block *blocks;
+    size_t count;
+    size_t out_cap;
+    size_t claimed;
+    size_t end;
+    int halted;
+    int stop;
+    int decoding;
+    int independent;
+    int flags;
+    struct ascii85_encoder encoder;
+    struct ascii85_decoder decoder;
+};
+
+// waits for input first, so a reader blocked on a quiet pipe still sees a stop
+static ssize_t read_polled(const int *stop, unsigned char *buffer, size_t size)
+{
+    struct pollfd input = {STDIN_FILENO, POLLIN, 0};
+    for (;;) {
+        if (__atomic_load_n(stop, __ATOMIC_RELAXED)) {
+            errno = ECANCELED;
+            return -1;
+        }
+        int ready = poll(&input, 1, POLL_MILLISECONDS);
+        if (ready > 0) {
+            return read(STDIN_FILENO, buffer, size);
+        }
+        if (ready < 0 && errno != EINTR) {
+            return -1;
+        }
+    }
+}
+
+// reads until the block is full or the input ends, or just once unless whole
+static ssize_t fill(const int *stop, unsigned char *buffer, size_t size, int whole)
+{
+    size_t done = 0;
+    while (done < size && (whole || done == 0)) {
+        ssize_t got = read_polled(stop, buffer + done, size - done);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got < 0) {
+            return -1;
+        }
+        if (got == 0) {
+            break;
+        }
+        done += got;
+    }
+    return done;
+}
+
+static int drain(unsigned char *buffer, size_t size)
+{
+    while (size > 0) {
+        ssize_t written = write(STDOUT_FILENO, buffer, size);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return 1;
+        }
+        buffer += written;
+        size -= written;
+    }
+    return 0;
+}
+
+static void *reader(void *arg)
+{
+    struct pipeline *pipeline = arg;
+    for (size_t sequence = 0;; sequence++) {
+        struct block *block = &pipeline->blocks[sequence % pipeline->count];
+        pthread_mutex_lock(&pipeline->lock);
+        while (!pipeline->stop && block->state != BLOCK_FREE) {
+            pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+        }
+        int stopped = pipeline->stop;
+        pthread_mutex_unlock(&pipeline->lock);
+        if (stopped) {
+            break;
+        }
+
+        // independent blocks must hold whole groups, in order ones go on as
+        // soon as anything arrives; an empty one ends the input
+        ssize_t got = fill(&pipeline->stop, block->in, BLOCK_SIZE, pipeline->independent);
+        pthread_mutex_lock(&pipeline->lock);
+        if (got < 0) {
+            pipeline->stop = 1;
+        } else {
+            block->sequence = sequence;
+            block->in_len = got;
+            block->last = pipeline->independent ? got < BLOCK_SIZE : got == 0;
+            block->state = BLOCK_FILLED;
+            if (block->last) {
+                pipeline->end = sequence + 1;
+            }
+        }
+        pthread_cond_broadcast(&pipeline->changed);
+        pthread_mutex_unlock(&pipeline->lock);
+        if (got < 0 || block->last) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+// the codec on one block; independent blocks get a fresh encoder each, the
+// others go through the shared state one after another
+static int transform(struct pipeline *pipeline, struct block *block)
+{
+    size_t length;
+    size_t tail;
+    block->out_len = 0;
+
+    if (pipeline->decoding) {
+        enum ascii85_status status = ascii85_decode_update(&pipeline->decoder, block->in, block->in_len,
+            block->out, pipeline->out_cap, &length);
+        block->out_len = length;
+        if (status != ASCII85_OK) {
+            return 1;
+        }
+        return block->last && ascii85_decode_finish(&pipeline->decoder) != ASCII85_OK;
+    }
+
+    struct ascii85_encoder fresh;
+    struct ascii85_encoder *encoder = &pipeline->encoder;
+    if (pipeline->independent) {
+        ascii85_encoder_init(&fresh, pipeline->flags);
+        encoder = &fresh;
+    }
+    if (ascii85_encode_update(encoder, block->in, block->in_len, block->out, pipeline->out_cap, &length)
+        != ASCII85_OK) {
+        return 1;
+    }
+    if (block->last) {
+        if (ascii85_encode_finish(encoder, block->out + length, pipeline->out_cap - length, &tail) != ASCII85_OK) {
+            return 1;
+        }
+        length += tail;
+        block->out[length++] = '\n';
+    }
+    block->out_len = length;
+    return 0;
+}
+
+static int claimable(const struct pipeline *pipeline)
+{
+    const struct block *block = &pipeline->blocks[pipeline->claimed % pipeline->count];
+    return block->state == BLOCK_FILLED && block->sequence == pipeline->claimed;
+}
+
+static void *worker(void *arg)
+{
+    struct pipeline *pipeline = arg;
+    pthread_mutex_lock(&pipeline->lock);
+    for (;;) {
+        while (!pipeline->stop && !pipeline->halted && pipeline->claimed < pipeline->end && !claimable(pipeline)) {
+            pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+        }
+        if (pipeline->stop || pipeline->halted || pipeline->claimed >= pipeline->end) {
+            break;
+        }
+        struct block *block = &pipeline->blocks[pipeline->claimed % pipeline->count];
+        block->state = BLOCK_BUSY;
+        pipeline->claimed++;
+        pthread_mutex_unlock(&pipeline->lock);
+
+        int failed = transform(pipeline, block);
+
+        // what was decoded before an error is still written, nothing after it
+        pthread_mutex_lock(&pipeline->lock);
+        block->failed = failed;
+        block->state = BLOCK_DONE;
+        if (failed) {
+            pipeline->halted = 1;
+        }
+        pthread_cond_broadcast(&pipeline->changed);
+    }
+    pthread_mutex_unlock(&pipeline->lock);
+    return NULL;
+}
+
+static void *writer(void *arg)
+{
+    struct pipeline *pipeline = arg;
+    for (size_t sequence = 0;; sequence++) {
+        struct block *block = &pipeline->blocks[sequence % pipeline->count];
+        pthread_mutex_lock(&pipeline->lock);
+        while (!pipeline->stop && sequence < pipeline->end
+            && !(block->state == BLOCK_DONE && block->sequence == sequence)) {
+            pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+        }
+        int finished = pipeline->stop || sequence >= pipeline->end;
+        pthread_mutex_unlock(&pipeline->lock);
+        if (finished) {
+            break;
+        }
+
+        int failed = drain(block->out, block->out_len) != 0 || block->failed;
+
+        pthread_mutex_lock(&pipeline->lock);
+        block->state = BLOCK_FREE;
+        if (failed) {
+            pipeline->stop = 1;
+        }
+        pthread_cond_broadcast(&pipeline->changed);
+        pthread_mutex_unlock(&pipeline->lock);
+        if (failed) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+// runs the reader, the writer and the workers, the calling thread is one of them
+static int run_pipeline(struct pipeline *pipeline, int workers)
+{
+    int retcode = 1;
+    pthread_mutex_init(&pipeline->lock, NULL);
+    pthread_cond_init(&pipeline->changed, NULL);
+    pipeline->count = 2 * workers + 2;
+    pipeline->claimed = 0;
+    pipeline->end = SIZE_MAX;
+    pipeline->halted = 0;
+    pipeline->stop = 0;
+
+    size_t ready = 0;
+    pthread_t *threads = malloc((workers + 1) * sizeof(pthread_t));
+    pipeline->blocks = calloc(pipeline->count, sizeof(struct block));
+    if (threads == NULL || pipeline->blocks == NULL) {
+        goto cleanup;
+    }
+    for (; ready < pipeline->count; ready++) {
+        struct block *block = &pipeline->blocks[ready];
+        block->state = BLOCK_FREE;
+        block->in = malloc(BLOCK_SIZE);
+        block->out = malloc(pipeline->out_cap);
+        if (block->in == NULL || block->out == NULL) {
+            free(block->in);
+            free(block->out);
+            goto cleanup;
+        }
+    }
+
+    pthread_t reading;
+    if (pthread_create(&reading, NULL, reader, pipeline) != 0) {
+        goto cleanup;
+    }
+    int started = 0;
+    if (pthread_create(&threads[started], NULL, writer, pipeline) == 0) {
+        started++;
+        while (started < workers && pthread_create(&threads[started], NULL, worker, pipeline) == 0) {
+            started++;
+        }
+        worker(pipeline);
+    } else {
+        pthread_mutex_lock(&pipeline->lock);
+        pipeline->stop = 1;
+        pthread_cond_broadcast(&pipeline->changed);
+        pthread_mutex_unlock(&pipeline->lock);
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    // a failed writer or worker leaves the reader to see the stop
+    pthread_mutex_lock(&pipeline->lock);
+    retcode = started == 0 || pipeline->stop;
+    pipeline->stop = 1;
+    pthread_cond_broadcast(&pipeline->changed);
+    pthread_mutex_unlock(&pipeline->lock);
+    pthread_join(reading, NULL);
+
+cleanup:
+    for (size_t i = 0; i < ready; i++) {
+        free(pipeline->blocks[i].in);
+        free(pipeline->blocks[i].out);
+    }
+    free(pipeline->blocks);
+    free(threads);
+    pthread_cond_destroy(&pipeline->changed);
+    pthread_mutex_destroy(&pipeline->lock);
+    return retcode;
+}
+
+int encode_pipeline(int threads, int flags)
+{
+    static struct pipeline pipeline;
+    pipeline.decoding = 0;
+
+    // plain blocks of whole groups encode on their own in any alphabet, the
+    // Adobe markers and the checksum need the blocks in order
+    pipeline.independent = !(flags & (ASCII85_ADOBE | ASCII85_CHECKSUM));
+    pipeline.flags = flags;
+    pipeline.out_cap = BLOCK_SIZE / 4 * 5 + 32;
+    ascii85_encoder_init(&pipeline.encoder, flags);
+    return run_pipeline(&pipeline, pipeline.independent ? threads : 1);
+}
+
+int decode_pipeline(int threads, int flags)
+{
+    static struct pipeline pipeline;
+    (void) threads;
+
+    // groups and whitespace cross the block boundaries, one worker decodes
+    // while the reader and the writer keep the I/O going
+    pipeline.decoding = 1;
+    pipeline.independent = 0;
+    pipeline.out_cap = ascii85_decoded_size_max(BLOCK_SIZE + 4, flags);
+    ascii85_decoder_init(&pipeline.decoder, flags);
+    return run_pipeline(&pipeline, 1);
+}
@@ -0,0 +1,12 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+// streamed encoding and decoding with the reading, the codec and the writing
+// on their own threads, handing large blocks along a bounded ring; plain
+// encoding spreads the blocks over several codec threads
+
+// function headers
+int encode_pipeline(int threads, int flags);
+int decode_pipeline(int threads, int flags);
+
+#endif // PIPELINE_H
@@ -0,0 +1,554 @@
+#include "ascii85.h"
+#include "kernels.h"
+#include <assert.h>
+#include <pthread.h>
+#include <string.h>
+
+// where an Adobe decoder is in the input
+#define STAGE_START 0
+#define STAGE_HELD 1
+#define STAGE_DATA 2
+#define STAGE_TILDE 3
+#define STAGE_END 4
+#define STAGE_TRAILER 5
+#define STAGE_DONE 6
+
+// groups encoded at once with ASCII85_CHECKSUM, the CRC reads them just before
+#define CHECKSUM_GROUPS 4096
+
+// the fastest kernels this cpu supports, picked by the first init; the
+// plain groups and the compaction have one kernel per alphabet
+static pthread_once_t select_once = PTHREAD_ONCE_INIT;
+static encode_kernel encode_plain[ALPHABETS];
+static encode_kernel encode_msb_groups;
+static find_zero_kernel find_zero;
+static compact_kernel compact[ALPHABETS];
+static decode_kernel decode_groups;
+static decode_kernel decode_msb_groups;
+static find_special_kernel find_special;
+static crc_kernel crc;
+
+static void select_kernels(void)
+{
+    compact_kernel unused;
+    encode_plain[ALPHABET_ASCII85] = encode_select();
+    encode_plain[ALPHABET_Z85] = encode_select_alphabet(ALPHABET_Z85);
+    encode_plain[ALPHABET_RFC1924] = encode_select_alphabet(ALPHABET_RFC1924);
+    encode_select_msb(&encode_msb_groups, &find_zero);
+    decode_select(&compact[ALPHABET_ASCII85], &decode_groups);
+    compact[ALPHABET_Z85] = decode_select_alphabet(ALPHABET_Z85);
+    compact[ALPHABET_RFC1924] = decode_select_alphabet(ALPHABET_RFC1924);
+    decode_select_msb(&unused, &decode_msb_groups, &find_special);
+    crc = crc32c_select();
+}
+
+static int alphabet(int flags)
+{
+    if (flags & ASCII85_Z85) {
+        return ALPHABET_Z85;
+    }
+    return flags & ASCII85_RFC1924 ? ALPHABET_RFC1924 : ALPHABET_ASCII85;
+}
+
+// the alphabets other than ASCII85 put the most significant digit first
+static decode_kernel plain_decoder(int flags)
+{
+    return alphabet(flags) == ALPHABET_ASCII85 ? decode_groups : decode_msb_groups;
+}
+
+// the marker in front of the checksum of the default format
+static unsigned char trailer_marker(int flags)
+{
+    return flags & ASCII85_RFC1924 ? '.' : '~';
+}
+
+static int is_space(unsigned char c)
+{
+    return c == ' ' || c - 9u <= 4u;
+}
+
+// the checksum group and the marker in front of it
+static size_t trailer_size(int flags)
+{
+    if (!(flags & ASCII85_CHECKSUM)) {
+        return 0;
+    }
+    return flags & ASCII85_ADOBE ? 5 : 6;
+}
+
+size_t ascii85_encoded_size(size_t size, int flags)
+{
+    // with ASCII85_ADOBE this is exact without zero groups, every 'z' saves 4
+    if (flags & ASCII85_ADOBE) {
+        return size / 4 * 5 + (size % 4 != 0 ? size % 4 + 1 : 0) + 4 + trailer_size(flags);
+    }
+    return (size + 3) / 4 * 5 + trailer_size(flags);
+}
+
+size_t ascii85_decoded_size_max(size_t size, int flags)
+{
+    return flags & ASCII85_ADOBE ? size * 4 : size / 5 * 4;
+}
+
+void ascii85_encoder_init(struct ascii85_encoder *encoder, int flags)
+{
+    assert(encoder != NULL);
+    assert(!(flags & ASCII85_ADOBE) || alphabet(flags) == ALPHABET_ASCII85);
+    pthread_once(&select_once, select_kernels);
+    encoder->flags = flags;
+    encoder->started = 0;
+    encoder->checksum = 0xFFFFFFFF;
+    encoder->pending_size = 0;
+}
+
+size_t ascii85_encode_update_size(const struct ascii85_encoder *encoder, size_t in_len)
+{
+    assert(encoder != NULL);
+
+    // exact, with ASCII85_ADOBE an upper bound
+    size_t size = (encoder->pending_size + in_len) / 4 * 5;
+    if ((encoder->flags & ASCII85_ADOBE) && !encoder->started) {
+        size += 2;
+    }
+    return size;
+}
+
+size_t ascii85_encode_input_limit(const struct ascii85_encoder *encoder, size_t out_cap)
+{
+    assert(encoder != NULL);
+    if ((encoder->flags & ASCII85_ADOBE) && !encoder->started) {
+        out_cap = out_cap > 2 ? out_cap - 2 : 0;
+    }
+    size_t limit = out_cap / 5 * 4;
+    return limit > encoder->pending_size ? limit - encoder->pending_size : 0;
+}
+
+size_t ascii85_encode_finish_size(const struct ascii85_encoder *encoder)
+{
+    assert(encoder != NULL);
+    if (encoder->flags & ASCII85_ADOBE) {
+        return (encoder->pending_size != 0 ? encoder->pending_size + 1 : 0) + (encoder->started ? 2 : 4)
+            + trailer_size(encoder->flags);
+    }
+    return (encoder->pending_size != 0 ? 5 : 0) + trailer_size(encoder->flags);
+}
+
+// encodes whole groups, with ASCII85_ADOBE in the shortest form; returns the output length
+static size_t encode_whole(const struct ascii85_encoder *encoder, const unsigned char *in, size_t groups,
+    unsigned char *out)
+{
+    if (!(encoder->flags & ASCII85_ADOBE)) {
+        encode_plain[alphabet(encoder->flags)](in, groups, out);
+        return groups * 5;
+    }
+
+    // runs of other groups go through the kernel, zero groups become single characters
+    int spaces = (encoder->flags & ASCII85_SPACES) != 0;
+    unsigned char *start = out;
+    while (groups > 0) {
+        size_t run = find_zero(in, groups, spaces);
+        encode_msb_groups(in, run, out);
+        in += run * 4;
+        out += run * 5;
+        groups -= run;
+
+        // the whole run of shortcuts, without going back to the kernels
+        for (; groups > 0; groups--, in += 4) {
+            uint32_t group;
+            memcpy(&group, in, 4);
+            if (group != 0 && (!spaces || group != SPACE_GROUP)) {
+                break;
+            }
+            *out++ = group == 0 ? 'z' : 'y';
+        }
+    }
+    return out - start;
+}
+
+// encodes whole groups and with ASCII85_CHECKSUM adds them to the CRC a piece at a time, while they are in cache
+static size_t encode_checked(struct ascii85_encoder *encoder, const unsigned char *in, size_t groups,
+    unsigned char *out)
+{
+    if (!(encoder->flags & ASCII85_CHECKSUM)) {
+        return encode_whole(encoder, in, groups, out);
+    }
+    unsigned char *start = out;
+    while (groups > 0) {
+        size_t piece = groups < CHECKSUM_GROUPS ? groups : CHECKSUM_GROUPS;
+        encoder->checksum = crc(encoder->checksum, in, piece * 4);
+        out += encode_whole(encoder, in, piece, out);
+        in += piece * 4;
+        groups -= piece;
+    }
+    return out - start;
+}
+
+// the final CRC as one more group after the marker
+static unsigned char *encode_trailer(const struct ascii85_encoder *encoder, unsigned char *out)
+{
+    uint32_t checksum = ~encoder->checksum;
+    unsigned char group[4] = {checksum >> 24, checksum >> 16, checksum >> 8, checksum};
+    if (!(encoder->flags & ASCII85_CHECKSUM)) {
+        return out;
+    }
+    if (encoder->flags & ASCII85_ADOBE) {
+        encode_msb_scalar(group, 1, out);
+    } else {
+        *out++ = trailer_marker(encoder->flags);
+        encode_plain[alphabet(encoder->flags)](group, 1, out);
+    }
+    return out + 5;
+}
+
+enum ascii85_status ascii85_encode_update(struct ascii85_encoder *encoder, const void *in, size_t in_len,
+    void *out, size_t out_cap, size_t *out_len)
+{
+    assert(encoder != NULL);
+    assert(in != NULL || in_len == 0);
+    assert(out_len != NULL);
+    const unsigned char *input = in;
+    unsigned char *output = out;
+    *out_len = 0;
+
+    // nothing is consumed unless all of the output fits
+    if (out_cap < ascii85_encode_update_size(encoder, in_len)) {
+        return ASCII85_BUFFER_TOO_SMALL;
+    }
+    if ((encoder->flags & ASCII85_ADOBE) && !encoder->started) {
+        *output++ = '<';
+        *output++ = '~';
+        encoder->started = 1;
+    }
+
+    // complete the group left from the last call
+    if (encoder->pending_size != 0) {
+        size_t take = 4 - encoder->pending_size < in_len ? 4 - encoder->pending_size : in_len;
+        memcpy(encoder->pending + encoder->pending_size, input, take);
+        encoder->pending_size += take;
+        input += take;
+        in_len -= take;
+        if (encoder->pending_size < 4) {
+            *out_len = output - (unsigned char *) out;
+            return ASCII85_OK;
+        }
+        output += encode_checked(encoder, encoder->pending, 1, output);
+        encoder->pending_size = 0;
+    }
+
+    // whole groups go straight from the input, the rest waits for the next call
+    size_t groups = in_len / 4;
+    output += encode_checked(encoder, input, groups, output);
+    encoder->pending_size = in_len - groups * 4;
+    memcpy(encoder->pending, input + groups * 4, encoder->pending_size);
+    *out_len = output - (unsigned char *) out;
+    return ASCII85_OK;
+}
+
+enum ascii85_status ascii85_encode_finish(struct ascii85_encoder *encoder, void *out, size_t out_cap, size_t *out_len)
+{
+    assert(encoder != NULL);
+    assert(out_len != NULL);
+    unsigned char *output = out;
+    *out_len = 0;
+    if (out_cap < ascii85_encode_finish_size(encoder)) {
+        return ASCII85_BUFFER_TOO_SMALL;
+    }
+
+    if (!(encoder->flags & ASCII85_ADOBE)) {
+        if (encoder->pending_size != 0) {
+
+            // a partial group is zero padded and still takes 5 characters
+            memset(encoder->pending + encoder->pending_size, 0, 4 - encoder->pending_size);
+            output += encode_checked(encoder, encoder->pending, 1, output);
+            encoder->pending_size = 0;
+        }
+        *out_len = encode_trailer(encoder, output) - (unsigned char *) out;
+        return ASCII85_OK;
+    }
+
+    if (!encoder->started) {
+        *output++ = '<';
+        *output++ = '~';
+        encoder->started = 1;
+    }
+
+    // a partial group of n bytes keeps the first n + 1 characters of the padded one
+    if (encoder->pending_size != 0) {
+        unsigned char group[5];
+        if (encoder->flags & ASCII85_CHECKSUM) {
+            encoder->checksum = crc(encoder->checksum, encoder->pending, encoder->pending_size);
+        }
+        memset(encoder->pending + encoder->pending_size, 0, 4 - encoder->pending_size);
+        encode_msb_scalar(encoder->pending, 1, group);
+        memcpy(output, group, encoder->pending_size + 1);
+        output += encoder->pending_size + 1;
+        encoder->pending_size = 0;
+    }
+    *output++ = '~';
+    *output++ = '>';
+    *out_len = encode_trailer(encoder, output) - (unsigned char *) out;
+    return ASCII85_OK;
+}
+
+void ascii85_decoder_init(struct ascii85_decoder *decoder, int flags)
+{
+    assert(decoder != NULL);
+    assert(!(flags & ASCII85_ADOBE) || alphabet(flags) == ALPHABET_ASCII85);
+    pthread_once(&select_once, select_kernels);
+    decoder->flags = flags;
+    decoder->stage = flags & ASCII85_ADOBE ? STAGE_START : STAGE_DATA;
+    decoder->status = ASCII85_OK;
+    decoder->checksum = 0xFFFFFFFF;
+    decoder->trailer_size = 0;
+    decoder->pending_size = 0;
+}
+
+size_t ascii85_decode_update_size(const struct ascii85_decoder *decoder, size_t in_len)
+{
+    assert(decoder != NULL);
+
+    // exact without whitespace, every skipped character only makes it smaller;
+    // with ASCII85_ADOBE a single 'z' can stand for 4 bytes
+    if (decoder->flags & ASCII85_ADOBE) {
+        return in_len * 4;
+    }
+    return (decoder->pending_size + in_len) / 5 * 4;
+}
+
+size_t ascii85_decode_input_limit(const struct ascii85_decoder *decoder, size_t out_cap)
+{
+    assert(decoder != NULL);
+    if (decoder->flags & ASCII85_ADOBE) {
+        return out_cap / 4;
+    }
+    size_t limit = out_cap / 4 * 5;
+    return limit > decoder->pending_size ? limit - decoder->pending_size : 0;
+}
+
+// decodes the groups of `count` compacted digits, handling the Adobe shortcuts;
+// what is left of a group stays at the start of the digits
+static enum ascii85_status decode_digits(struct ascii85_decoder *decoder, size_t count, unsigned char *out,
+    size_t *out_len)
+{
+    unsigned char *digits = decoder->digits;
+    size_t i = 0;
+    *out_len = 0;
+
+    if (!(decoder->flags & ASCII85_ADOBE)) {
+        size_t groups = count / 5;
+        size_t decoded = plain_decoder(decoder->flags)(digits, groups, out);
+        *out_len = decoded * 4;
+        if (decoded != groups) {
+            return ASCII85_OVERFLOW;
+        }
+        i = groups * 5;
+    } else {
+        while (1) {
+            size_t special = i + find_special(digits + i, count - i);
+            size_t groups = (special - i) / 5;
+            size_t decoded = decode_msb_groups(digits + i, groups, out + *out_len);
+            *out_len += decoded * 4;
+            if (decoded != groups) {
+                return ASCII85_OVERFLOW;
+            }
+            i += groups * 5;
+            if (special == count) {
+                break;
+            }
+
+            // 'z' and 'y' only stand for whole groups, the other digits above 'u' are invalid
+            if (special != i) {
+                return ASCII85_INVALID_CHARACTER;
+            }
+            for (; i < count; i++, *out_len += 4) {
+                if (digits[i] == ZERO_DIGIT) {
+                    memset(out + *out_len, 0, 4);
+                } else if (digits[i] == SPACES_DIGIT && (decoder->flags & ASCII85_SPACES)) {
+                    memset(out + *out_len, ' ', 4);
+                } else {
+                    break;
+                }
+            }
+            if (i == special) {
+                return ASCII85_INVALID_CHARACTER;
+            }
+        }
+    }
+
+    decoder->pending_size = count - i;
+    memmove(digits, digits + i, decoder->pending_size);
+    return ASCII85_OK;
+}
+
+// decodes the final group of an Adobe stream, n digits padded with 'u' give n - 1 bytes
+static enum ascii85_status decode_last(struct ascii85_decoder *decoder, unsigned char *out, size_t *out_len)
+{
+    size_t pending = decoder->pending_size;
+    unsigned char group[4];
+    *out_len = 0;
+    if (pending == 0) {
+        return ASCII85_OK;
+    }
+    if (pending == 1) {
+        return ASCII85_TRUNCATED;
+    }
+    memset(decoder->digits + pending, MAX_DIGIT, 5 - pending);
+    if (decode_msb_scalar(decoder->digits, 1, group) != 1) {
+        return ASCII85_OVERFLOW;
+    }
+    memcpy(out, group, pending - 1);
+    decoder->pending_size = 0;
+    *out_len = pending - 1;
+    return ASCII85_OK;
+}
+
+// collects the digits of the checksum group and compares it once it is complete
+static enum ascii85_status decode_trailer(struct ascii85_decoder *decoder, unsigned char c)
+{
+    unsigned char group[4];
+    unsigned char digit[1 + COMPACT_SLACK];
+    size_t consumed;
+    if (compact[alphabet(decoder->flags)](&c, 1, digit, &consumed) != 1 || digit[0] > MAX_DIGIT) {
+        return ASCII85_INVALID_CHARACTER;
+    }
+    decoder->trailer[decoder->trailer_size++] = digit[0];
+    if (decoder->trailer_size < 5) {
+        return ASCII85_OK;
+    }
+    decoder->stage = STAGE_DONE;
+    if ((decoder->flags & ASCII85_ADOBE ? decode_msb_scalar : plain_decoder(decoder->flags))(decoder->trailer, 1, group)
+        != 1) {
+        return ASCII85_INVALID_CHARACTER;
+    }
+    uint32_t checksum = (uint32_t) group[0] << 24 | (uint32_t) group[1] << 16 | (uint32_t) group[2] << 8 | group[3];
+    return checksum == ~decoder->checksum ? ASCII85_OK : ASCII85_CHECKSUM_MISMATCH;
+}
+
+enum ascii85_status ascii85_decode_update(struct ascii85_decoder *decoder, const void *in, size_t in_len,
+    void *out, size_t out_cap, size_t *out_len)
+{
+    assert(decoder != NULL);
+    assert(in != NULL || in_len == 0);
+    assert(out_len != NULL);
+    const unsigned char *input = in;
+    unsigned char *output = out;
+    *out_len = 0;
+
+    // an error stops the decoder for good
+    if (decoder->status != ASCII85_OK) {
+        return decoder->status;
+    }
+    if (out_cap < ascii85_decode_update_size(decoder, in_len)) {
+        return ASCII85_BUFFER_TOO_SMALL;
+    }
+
+    while (in_len > 0 && decoder->status == ASCII85_OK) {
+        unsigned char c = *input;
+        size_t length;
+
+        switch (decoder->stage) {
+            case STAGE_START:
+            case STAGE_HELD:
+
+                // an optional "<~", a '<' without the '~' is the first digit
+                if (is_space(c)) {
+                    length = 1;
+                } else if (decoder->stage == STAGE_START && c == '<') {
+                    decoder->stage = STAGE_HELD;
+                    length = 1;
+                } else if (decoder->stage == STAGE_HELD && c == '~') {
+                    decoder->stage = STAGE_DATA;
+                    length = 1;
+                } else {
+                    if (decoder->stage == STAGE_HELD) {
+                        decoder->digits[decoder->pending_size++] = '<' - 33;
+                    }
+                    decoder->stage = STAGE_DATA;
+                    length = 0;
+                }
+                break;
+            case STAGE_TILDE:
+                if (c == '>') {
+                    decoder->stage = decoder->flags & ASCII85_CHECKSUM ? STAGE_TRAILER : STAGE_END;
+                } else if (!is_space(c)) {
+                    decoder->status = ASCII85_INVALID_CHARACTER;
+                }
+                length = 1;
+                break;
+            case STAGE_END:
+                length = in_len;
+                break;
+            case STAGE_TRAILER:
+            case STAGE_DONE:
+
+                // only whitespace may follow the checksum
+                if (!is_space(c)) {
+                    decoder->status = decoder->stage == STAGE_TRAILER ? decode_trailer(decoder, c)
+                        : ASCII85_INVALID_CHARACTER;
+                }
+                length = 1;
+                break;
+            default: {
+                length = in_len < ASCII85_DECODE_CHUNK ? in_len : ASCII85_DECODE_CHUNK;
+
+                // drop whitespace and check for invalid characters
+                size_t consumed;
+                size_t decoded;
+                size_t count = decoder->pending_size
+                    + compact[alphabet(decoder->flags)](input, length, decoder->digits + decoder->pending_size, &consumed);
+
+                // output 5 characters at a time, what was decoded before an error is still written
+                decoder->status = decode_digits(decoder, count, output, &decoded);
+                if (decoder->flags & ASCII85_CHECKSUM) {
+                    decoder->checksum = crc(decoder->checksum, output, decoded);
+                }
+                output += decoded;
+                if (decoder->status != ASCII85_OK || consumed == length) {
+                    break;
+                }
+
+                // the Adobe end of data marker, it finishes the last group
+                if ((decoder->flags & ASCII85_ADOBE) && input[consumed] == '~') {
+                    decoder->status = decode_last(decoder, output, &decoded);
+                    if (decoder->flags & ASCII85_CHECKSUM) {
+                        decoder->checksum = crc(decoder->checksum, output, decoded);
+                    }
+                    output += decoded;
+                    decoder->stage = STAGE_TILDE;
+                    length = consumed + 1;
+                } else if ((decoder->flags & ASCII85_CHECKSUM) && input[consumed] == trailer_marker(decoder->flags)) {
+
+                    // the checksum marker of the default format, the data has to end in a whole group
+                    decoder->status = decoder->pending_size != 0 ? ASCII85_TRUNCATED : ASCII85_OK;
+                    decoder->stage = STAGE_TRAILER;
+                    length = consumed + 1;
+                } else {
+                    decoder->status = ASCII85_INVALID_CHARACTER;
+                }
+                break;
+            }
+        }
+        input += length;
+        in_len -= length;
+    }
+    *out_len = output - (unsigned char *) out;
+    return decoder->status;
+}
+
+enum ascii85_status ascii85_decode_finish(struct ascii85_decoder *decoder)
+{
+    assert(decoder != NULL);
+    if (decoder->status != ASCII85_OK) {
+        return decoder->status;
+    }
+
+    // check if input length was not divisible by 5, or the Adobe data or the checksum didn't end
+    if (decoder->flags & ASCII85_CHECKSUM) {
+        if (decoder->stage != STAGE_DONE) {
+            decoder->status = ASCII85_TRUNCATED;
+        }
+    } else if ((decoder->flags & ASCII85_ADOBE) ? decoder->stage != STAGE_END : decoder->pending_size != 0) {
+        decoder->status = ASCII85_TRUNCATED;
+    }
+    return decoder->status;
+}